@@ -1,137 +1,81 @@
 
 #define _DEFAULT_SOURCE
 #define _BSD_SOURCE
+#ifndef _GNU_SOURCE // g++ already defines it
 #define _GNU_SOURCE
+#endif
 
 #include <cerrno>
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <cstdarg>
 #include <ctime>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
-#include <iostream>
-#include <sstream>
 #include <string>
 #include <vector>
 
-/*** defines ***/
-#define CTRL_KEY(k) ((k) & 0x1f)
-#define KILO_VERSION "0.0.1"
-#define KILO_TAB_STOP 8
-#define KILO_QUIT_TIMES 3
-
-enum editorKeys
-{
-    BACKSPACE = 127,
-    ARROW_LEFT = 1000,
-    ARROW_RIGHT,
-    ARROW_UP,
-    ARROW_DOWN,
-    DEL_KEY,
-    HOME_KEY,
-    END_KEY,
-    PAGE_UP,
-    PAGE_DOWN
-};
-
-enum editorHighlight {
-    HL_NORMAL = 0,
-    HL_COMMENT,
-    HL_KEYWORD1,
-    HL_KEYWORD2,
-    HL_STRING,
-    HL_NUMBER,
-    HL_MATCH
-};
-
-#define HL_HIGHLIGHT_NUMBERS (1 << 0)
-#define HL_HIGHLIGHT_STRINGS (1 << 1)
-
-/*** data ***/
-
-struct editorSyntax
-{
-    std::string filetype;
-    std::vector<std::string> filematch;
-    int flags;
-};
+#include "bolt_core.h"
 
 /*
- * Each line of text is stored in an ERow.
- *  - 'chars' holds the actual text of the line
- *  - 'render' is an expanded version that replaces tabs with spaces
+ * The terminal front end: raw mode, window size and the main loop run
+ * on libbolt-core. It can also record a session's input, or replay one
+ * without a terminal for benchmarks.
  */
-struct ERow
-{
-    std::string chars;  // The actual text of the row
-    std::string render; // The rendered version (tabs expanded, etc.)
-    std::vector<int> hl;
-};
 
-/*
- * The main editor configuration/state struct
- */
-struct editorConfig
-{
-    int cx, cy;     // Cursor x (column) and y (row) position in the file
-    int rx;         // Rendered x position (when we account for tabs, etc.)
-    int rowoff;     // Offset of the row displayed (top of the screen)
-    int coloff;     // Offset of the column displayed (left of the screen)
-    int screenrows; // Number of rows we can display
-    int screencols; // Number of columns we can display
-    bool dirty;     // Track if the file is modified
-    std::string filename;
-    std::string statusmsg;
-    time_t statusmsg_time;
+/*** defines ***/
+#define BOLT_IO_BLOCK 65536
+#define BOLT_REPLAY_ROWS 24
+#define BOLT_REPLAY_COLS 80
 
-    struct EditorSyntax *syntax;
-    struct termios orig_termios;
+// Button, drag and SGR (1006) extended mouse reporting
+#define MOUSE_REPORTING_ON "\x1b[?1000h\x1b[?1002h\x1b[?1006h"
+#define MOUSE_REPORTING_OFF "\x1b[?1006l\x1b[?1002l\x1b[?1000l"
 
-    // Each line in the file is stored in a vector of ERow
-    std::vector<ERow> rows;
-};
+/*** data ***/
 
-/*** Global editor state ***/
-static editorConfig E;
+static struct termios orig_termios;
 
-/*** filetype ***/
-struct EditorSyntax
+struct replayEvent
 {
-    std::string filetype;                // File type name
-    std::vector<std::string> extensions; // File extensions
-    std::vector<std::string> keywords;
-    std::string singleline_comment_start;
-    int flags;                           // Syntax highlighting flags
+    int gap_ms;
+    std::string bytes;
 };
 
-std::vector<EditorSyntax> HLDB = {
-    {
-        "c",                  // File type
-        {".c", ".h", ".cpp"}, // Extensions
-        {
-            "switch", "if", "while", "for", "break", "continue", "return", "else",
-            "struct", "union", "typedef", "static", "enum", "class", "case",
-            "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
-            "void|"},
-        "//",
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS // Flags
-    },
+struct replayState
+{
+    bool active = false;
+    int rows = BOLT_REPLAY_ROWS, cols = BOLT_REPLAY_COLS;
+    std::vector<replayEvent> events;
+    size_t next = 0;               // Next event to deliver
+    size_t pos = 0;                // Bytes of events[next - 1] delivered so far
+    bool waiting = false;          // An event is in, its frame isn't out yet
+    bool timed_out = false;        // The read timeout for it was reported
+    long long t0 = 0;              // Process start
+    long long arrived = 0;         // When the current event was delivered
+    long long drawn = 0;           // When the last frame went out
+    long long due = 0;             // When the next event arrives
+    long long startup_ns = -1;     // Start to the first frame
+    long startup_minflt = 0;       // Page faults up to the first frame
+    long startup_majflt = 0;
+    long long idle_ns = 0;         // Between frames and the next events
+    long long output_bytes = 0;    // Frames that would have been written
+    std::vector<long long> latency_ns;
+    FILE *record = nullptr;        // --record output
+    long long last_input = 0;      // For the gaps written by --record
 };
 
-// Get the number of entries
-#define HLDB_ENTRIES HLDB.size()
-
-/*** prototypes ***/
-void editorSetStatusMessage(const char *fmt, ...);
-void editorRefreshScreen();
-std::string editorPrompt(const std::string &prompt, void (*callback)(std::string &, int));
+static replayState replay;
+static BoltEditor *bolt; // For the replay report
 
 /*** terminal ***/
 
@@ -154,7 +98,8 @@ static void die(const char *s)
  */
 static void disableRawMode()
 {
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
+    write(STDOUT_FILENO, MOUSE_REPORTING_OFF, sizeof(MOUSE_REPORTING_OFF) - 1);
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios) == -1)
     {
         die("tcsetattr");
     }
@@ -166,7 +111,7 @@ static void disableRawMode()
  */
 static void enableRawMode()
 {
-    if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1)
+    if (tcgetattr(STDIN_FILENO, &orig_termios) == -1)
     {
         die("tcgetattr");
     }
@@ -174,7 +119,7 @@ static void enableRawMode()
     // Ensure we restore normal mode on exit
     atexit(disableRawMode);
 
-    struct termios raw = E.orig_termios;
+    struct termios raw = orig_termios;
     // Input flags
     raw.c_iflag &= static_cast<unsigned int>(~(BRKINT | ICRNL | INPCK | ISTRIP | IXON));
     // Output flags
@@ -191,93 +136,10 @@ static void enableRawMode()
     {
         die("tcsetattr");
     }
+    write(STDOUT_FILENO, MOUSE_REPORTING_ON, sizeof(MOUSE_REPORTING_ON) - 1);
 }
 
-/**
- * Read one key from stdin, handling escape sequences.
- */
-static int editorReadKey()
-{
-    int nread;
-    char c;
-    while ((nread = (int)read(STDIN_FILENO, &c, 1)) != 1)
-    {
-        if (nread == -1 && errno != EAGAIN)
-            die("read");
-    }
-
-    if (c == '\x1b')
-    {
-        // Possible escape sequence
-        char seq[3];
-        // If we can't read 2 more bytes, it's just ESC.
-        if (read(STDIN_FILENO, &seq[0], 1) != 1)
-            return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
-
-        if (seq[0] == '[')
-        {
-            if (seq[1] >= '0' && seq[1] <= '9')
-            {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1)
-                    return '\x1b';
-                if (seq[2] == '~')
-                {
-                    switch (seq[1])
-                    {
-                    case '1':
-                        return HOME_KEY;
-                    case '3':
-                        return DEL_KEY;
-                    case '4':
-                        return END_KEY;
-                    case '5':
-                        return PAGE_UP;
-                    case '6':
-                        return PAGE_DOWN;
-                    case '7':
-                        return HOME_KEY;
-                    case '8':
-                        return END_KEY;
-                    }
-                }
-            }
-            else
-            {
-                switch (seq[1])
-                {
-                case 'A':
-                    return ARROW_UP;
-                case 'B':
-                    return ARROW_DOWN;
-                case 'C':
-                    return ARROW_RIGHT;
-                case 'D':
-                    return ARROW_LEFT;
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
-                }
-            }
-        }
-        else if (seq[0] == 'O')
-        {
-            switch (seq[1])
-            {
-            case 'H':
-                return HOME_KEY;
-            case 'F':
-                return END_KEY;
-            }
-        }
-        return '\x1b';
-    }
-
-    // Not an escape sequence, just return the character
-    return c;
-}
+/*** terminal queries ***/
 
 /**
  * Use a sequence trick to query the terminal for the cursor position.
@@ -329,1001 +191,348 @@ static int getWindowSize(int &rows, int &cols)
     }
 }
 
-/*** syntax highlighting ***/
-
-static int is_separator(int c)
-{
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
-}
-
-static void editorUpdateSyntax(ERow &row)
-{
-    // Initialize all characters to normal highlighting.
-    row.hl.assign(row.render.size(), HL_NORMAL);
-
-    // Get the list of keywords from the currently selected syntax.
-    std::vector<std::string> keywords;
-    if (E.syntax)
-    {
-        keywords = E.syntax->keywords;
-    }
-
-    int prev_sep = 1;  // True if the previous character is a separator.
-    int in_string = 0; // 0 means not in a string; otherwise holds the quote char.
-    size_t i = 0;
-    while (i < row.render.size())
-    {
-        // Handle single-line comments.
-        if (E.syntax && !E.syntax->singleline_comment_start.empty() && !in_string)
-        {
-            const std::string &comment_start = E.syntax->singleline_comment_start;
-            if (i + comment_start.size() <= row.render.size() &&
-                row.render.substr(i, comment_start.size()) == comment_start)
-            {
-                std::fill(row.hl.begin() + i, row.hl.end(), HL_COMMENT);
-                break;
-            }
-        }
-
-        char c = row.render[i];
-        unsigned char prev_hl = (i > 0) ? row.hl[i - 1] : HL_NORMAL;
-
-        // Handle strings.
-        if (in_string)
-        {
-            row.hl[i] = HL_STRING;
-            if (c == in_string)
-                in_string = 0;
-            i++;
-            prev_sep = 1;
-            continue;
-        }
-        else
-        {
-            if (c == '"' || c == '\'')
-            {
-                in_string = c;
-                row.hl[i] = HL_STRING;
-                i++;
-                continue;
-            }
-        }
-
-        // Handle numbers.
-        if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-            (c == '.' && prev_hl == HL_NUMBER))
-        {
-            row.hl[i] = HL_NUMBER;
-            i++;
-            prev_sep = 0;
-            continue;
-        }
-
-        // Handle keywords.
-        // Only check for a keyword match if the previous character was a separator.
-        bool matched = false;
-        if (prev_sep)
-        {
-            for (const auto &kw : keywords)
-            {
-                // Copy the keyword; if it ends with a '|' then remove it and use a different color.
-                std::string key = kw;
-                int kw_color = HL_KEYWORD1;
-                if (!key.empty() && key.back() == '|')
-                {
-                    key.pop_back();
-                    kw_color = HL_KEYWORD2;
-                }
-                size_t klen = key.size();
-                // Check if the current substring matches the keyword, and ensure that the character
-                // after the keyword is a separator (or the end of the line).
-                if (i + klen <= row.render.size() &&
-                    row.render.compare(i, klen, key) == 0 &&
-                    (i + klen == row.render.size() || is_separator(row.render[i + klen])))
-                {
-                    std::fill(row.hl.begin() + i, row.hl.begin() + i + klen, kw_color);
-                    i += klen;
-                    matched = true;
-                    break;
-                }
-            }
-        }
-        if (matched)
-        {
-            prev_sep = 0;
-            continue;
-        }
-
-        // Update the "previous separator" status and move to the next character.
-        prev_sep = is_separator(c);
-        i++;
-    }
-}
-
-static int editorSyntaxColor(int hl) {
-    switch(hl) {
-        case HL_COMMENT: return 36;
-        case HL_KEYWORD1: return 33;
-        case HL_KEYWORD2: return 32;
-        case HL_STRING: return 35;
-        case HL_NUMBER: return 31;
-        case HL_MATCH: return 34;
-        default: return 37;
-    }
-}
-
-static void editorSelectSyntaxHighlight()
-{
-    E.syntax = nullptr; // Reset any previously selected syntax
-
-    if (E.filename.empty())
-        return;
-
-    // Find the last '.' in the filename to extract the extension.
-    size_t dot = E.filename.find_last_of('.');
-    if (dot == std::string::npos)
-        return;
-
-    std::string file_ext = E.filename.substr(dot);
-
-    E.syntax = &HLDB[0];
-}
-
-/*** row operations ***/
-
 /**
- * Given a cursor x position (E.cx) in 'row->chars', this computes the
- * corresponding x position in the rendered version (row->render),
- * which accounts for tabs.
+ * Read all of stdin (for "cmd | Bolt -"), then point stdin back at the
+ * terminal so keyboard input still works.
  */
-static int editorRowCxToRx(const ERow &row, int cx)
+static std::string editorReadStdin()
 {
-    int rx = 0;
-    for (int j = 0; j < cx; j++)
-    {
-        if (row.chars[j] == '\t')
-        {
-            rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-        }
-        rx++;
-    }
-    return rx;
-}
+    std::string text;
+    char buf[BOLT_IO_BLOCK];
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+        text.append(buf, n);
 
-/**
- * Build the 'render' string from 'chars' by expanding tabs into
- * the appropriate number of spaces.
- */
-static void editorUpdateRow(ERow &row)
-{
-    std::ostringstream render;
-    for (char c : row.chars)
-    {
-        if (c == '\t')
-        {
-            // Insert at least one space
-            render << ' ';
-            // Insert additional spaces until we hit a tab stop
-            while (render.tellp() % KILO_TAB_STOP != 0)
-            {
-                render << ' ';
-            }
-        }
-        else
-        {
-            render << c;
-        }
-    }
-    row.render = render.str();
-    editorUpdateSyntax(row);
+    int tty = open("/dev/tty", O_RDWR);
+    if (tty == -1 || dup2(tty, STDIN_FILENO) == -1)
+        die("/dev/tty");
+    close(tty);
+    return text;
 }
 
-/**
- * Insert a new row into E.rows at index 'at'.
- */
-static void editorInsertRow(int at, const std::string &s)
-{
-    if (at < 0 || at > (int)E.rows.size())
-        return;
-
-    ERow newRow;
-    newRow.chars = s;
-    editorUpdateRow(newRow);
+/*** tty ***/
 
-    E.rows.insert(E.rows.begin() + at, newRow);
-    E.dirty = true;
-}
-
-/**
- * Delete row at index 'at'.
- */
-static void editorDelRow(int at)
+static long long nowNs()
 {
-    if (at < 0 || at >= (int)E.rows.size())
-        return;
-    E.rows.erase(E.rows.begin() + at);
-    E.dirty = true;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 /**
- * Insert a single character 'c' into row 'row' at position 'at'.
+ * Append what the terminal just sent to the --record file.
  */
-static void editorRowInsertChar(ERow &row, int at, char c)
+static void recordInput(const unsigned char *buf, size_t len)
 {
-    if (at < 0 || at > (int)row.chars.size())
+    long long now = nowNs();
+    fprintf(replay.record, "%lld ", (now - replay.last_input) / 1000000);
+    replay.last_input = now;
+    for (size_t i = 0; i < len; i++)
     {
-        at = (int)row.chars.size();
+        unsigned char c = buf[i];
+        if (c == '\x1b')
+            fputs("\\e", replay.record);
+        else if (c == '\r')
+            fputs("\\r", replay.record);
+        else if (c == '\n')
+            fputs("\\n", replay.record);
+        else if (c == '\t')
+            fputs("\\t", replay.record);
+        else if (c == '\\')
+            fputs("\\\\", replay.record);
+        else if (c < 0x20 || c >= 0x7f)
+            fprintf(replay.record, "\\x%02x", c);
+        else
+            fputc(c, replay.record);
     }
-    row.chars.insert(row.chars.begin() + at, c);
-    editorUpdateRow(row);
-    E.dirty = true;
+    fputc('\n', replay.record);
+    fflush(replay.record);
 }
 
-/**
- * Append a string 's' to row 'row'.
- */
-static void editorRowAppendString(ERow &row, const std::string &s)
+static ssize_t ttyRead(unsigned char *buf, size_t len)
 {
-    row.chars += s;
-    editorUpdateRow(row);
-    E.dirty = true;
+    ssize_t n = read(STDIN_FILENO, buf, len);
+    if (n > 0 && replay.record)
+        recordInput(buf, (size_t)n);
+    return n;
 }
 
-/**
- * Delete the character at position 'at' in row 'row'.
- */
-static void editorRowDelChar(ERow &row, int at)
+static bool ttyPending()
 {
-    if (at < 0 || at >= (int)row.chars.size())
-        return;
-    row.chars.erase(row.chars.begin() + at);
-    editorUpdateRow(row);
-    E.dirty = true;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
 }
 
-/*** editor operations ***/
-
-/**
- * Insert a character at the current cursor position. If the cursor
- * is beyond the last row, create a new row first.
- */
-static void editorInsertChar(char c)
+static void ttyWrite(const char *buf, size_t len)
 {
-    if (E.cy == (int)E.rows.size())
-    {
-        // We are on a 'virtual' row past the end, so create a new empty row
-        editorInsertRow((int)E.rows.size(), "");
-    }
-    editorRowInsertChar(E.rows[E.cy], E.cx, c);
-    E.cx++;
+    write(STDOUT_FILENO, buf, len);
 }
 
-/**
- * Insert a newline at the current cursor. If E.cx == 0,
- * just insert a blank row above the current row; otherwise,
- * split the current line at E.cx.
- */
-static void editorInsertNewline()
+static void ttyQuit()
 {
-    if (E.cx == 0)
-    {
-        // Insert an empty row before this one
-        editorInsertRow(E.cy, "");
-    }
-    else
-    {
-        ERow &row = E.rows[E.cy];
-        // The substring from E.cx onward
-        std::string splitText = row.chars.substr(E.cx);
-        // Trim the current row
-        row.chars.erase(E.cx);
-        editorUpdateRow(row);
-
-        // Insert the new row below
-        editorInsertRow(E.cy + 1, splitText);
-    }
-    E.cy++;
-    E.cx = 0;
+    std::exit(0);
 }
 
-/**
- * Delete the character behind the cursor. If we're at the start
- * of a line, then we merge with the previous line.
- */
-static void editorDelChar()
-{
-    if (E.cy == (int)E.rows.size())
-        return;
-    if (E.cx == 0 && E.cy == 0)
-        return;
-
-    ERow &row = E.rows[E.cy];
-    if (E.cx > 0)
-    {
-        editorRowDelChar(row, E.cx - 1);
-        E.cx--;
-    }
-    else
-    {
-        // Merge current row into previous row
-        E.cx = (int)E.rows[E.cy - 1].chars.size();
-        editorRowAppendString(E.rows[E.cy - 1], row.chars);
-        editorDelRow(E.cy);
-        E.cy--;
-    }
-}
+static const BoltTerminal tty = {ttyRead, ttyPending, ttyWrite, ttyQuit};
 
-/*** file i/o ***/
+/*** replay ***/
 
-/**
- * Convert all rows to a single string buffer, each row followed by a newline.
+/*
+ * Sessions recorded with --record can be replayed with --replay, without
+ * a terminal, for benchmarks. A session file holds one input event per
+ * line: the milliseconds since the previous event, optionally "*N" to
+ * repeat it N times, a space, then the bytes the terminal sent with \e,
+ * \r, \n, \t, \\ and \xHH escapes. Lines starting with '#' are comments.
+ *
+ *     350 \x06
+ *     90*5 x
+ *     40*200 \e[6~
+ *
+ * The gap before each event goes to idle work as the user's pause would,
+ * but isn't slept through. Each event is timed from its bytes arriving
+ * to the next frame being drawn.
  */
-static std::string editorRowsToString()
-{
-    std::ostringstream out;
-    for (auto &row : E.rows)
-    {
-        out << row.chars << "\n";
-    }
-    return out.str();
-}
 
-/**
- * Open a file, read its contents line by line into E.rows.
- */
-static void editorOpen(const std::string &filename)
+static std::string unescape(const std::string &s)
 {
-    E.filename = filename;
-    editorSelectSyntaxHighlight();
-
-    std::ifstream file(filename);
-    if (!file.is_open())
-    {
-        die(("fopen: " + filename).c_str());
-    }
-
-    std::string line;
-    while (std::getline(file, line))
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++)
     {
-        // Strip out any trailing carriage return
-        if (!line.empty() && line.back() == '\r')
+        if (s[i] != '\\' || i + 1 == s.size())
         {
-            line.pop_back();
+            out += s[i];
+            continue;
+        }
+        char c = s[++i];
+        if (c == 'e')
+            out += '\x1b';
+        else if (c == 'r')
+            out += '\r';
+        else if (c == 'n')
+            out += '\n';
+        else if (c == 't')
+            out += '\t';
+        else if (c == 'x' && i + 1 < s.size() && isxdigit((unsigned char)s[i + 1]))
+        {
+            size_t used = 0;
+            out += (char)std::stoi(s.substr(i + 1, 2), &used, 16);
+            i += used;
         }
-        editorInsertRow((int)E.rows.size(), line);
+        else
+            out += c;
     }
-    file.close();
-    E.dirty = false;
+    return out;
 }
 
 /**
- * Save the current text buffer to disk. If no filename is set, prompt for one.
+ * Read a session file into replay.events. Returns false if it can't be
+ * read or a line is malformed.
  */
-static void editorSave()
+static bool replayLoad(const std::string &path)
 {
-    if (E.filename.empty())
-    {
-        std::string newName = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        if (newName.empty())
-        {
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-        editorSelectSyntaxHighlight();
-        E.filename = newName;
-    }
-
-    std::ofstream out(E.filename, std::ios::out | std::ios::trunc);
-    if (!out.is_open())
-    {
-        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
-        return;
-    }
-    std::string buffer = editorRowsToString();
-    out << buffer;
-    out.close();
-
-    E.dirty = false;
-    editorSetStatusMessage("%lu bytes written to disk", (unsigned long)buffer.size());
-}
-
-/*** find ***/
-static void editorFindCallback(std::string &query, int key) {
-    static int last_match = -1;
-    static int direction = 1;
-
-    static int saved_hl_line;
-    static std::vector<int> *saved_hl = nullptr;
-
-    if (saved_hl){  
-        E.rows[saved_hl_line].hl = *saved_hl;
-        delete saved_hl;
-        saved_hl = nullptr;
-    }
-
-    if (key == '\r' || key == '\x1b')
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::string line;
+    while (std::getline(in, line))
     {
-        last_match = -1;
-        direction = 1;
-        return;
-    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
-        direction = 1;
-    } else if (key == ARROW_LEFT || key == ARROW_UP) {
-        direction = -1;
-    } else {
-        last_match = -1;
-        direction = 1;
-    }
-
-    if (last_match == -1) direction = 1;
-    int current = last_match;
-
-    for (size_t i = 0; i < E.rows.size(); i++){
-        current += direction;
-        if (current == -1){
-            current = E.rows.size() - 1;
-        } 
-        else if (current == int(E.rows.size())){
-            current = 0;
-        }
-        size_t pos = E.rows[current].chars.find(query);
-        if (pos != std::string::npos) {
-            last_match = current;
-            E.cy = current;
-            E.cx = static_cast<int>(pos);
-            E.rowoff = E.rows.size();
-
-            saved_hl_line = current;
-            saved_hl = new std::vector<int>(E.rows[current].hl);
-
-            E.rows[current].hl.assign(E.rows[current].render.size(), HL_NORMAL); // Reset highlighting
-            std::fill(E.rows[current].hl.begin() + pos, E.rows[current].hl.begin() + pos + query.size(), HL_MATCH);
-
-            break;
-        }
-    }
-}
-
-static void editorFind() {
-    int saved_cx = E.cx;
-    int saved_cy = E.cy;
-    int saved_coloff = E.coloff;
-    int saved_rowoff = E.rowoff;
-
-    std::string query = editorPrompt("Search: %s (ESC to cancel)", editorFindCallback);
-
-    if (query.empty()){
-        E.cx = saved_cx;
-        E.cy = saved_cy;
-        E.coloff = saved_coloff;
-        E.rowoff = saved_rowoff;
+        if (line.empty() || line[0] == '#')
+            continue;
+        int gap = 0, count = 1;
+        if (sscanf(line.c_str(), "%d*%d", &gap, &count) < 1 || gap < 0 || count < 1)
+            return false;
+        size_t space = line.find(' ');
+        replayEvent ev = {gap, space == std::string::npos ? "" : unescape(line.substr(space + 1))};
+        replay.events.insert(replay.events.end(), count, ev);
     }
+    return true;
 }
 
-/*** append buffer for rendering ***/
-
-/*
- * A small struct for building output strings more efficiently,
- * similar to a dynamic string or std::stringstream usage.
- */
-struct abuf
-{
-    std::string b;
-};
-
 /**
- * Append a string 's' of length 'len' to abuf 'ab'.
- */
-static void abAppend(abuf &ab, const char *s, int len)
-{
-    ab.b.append(s, len);
+ * Print the timings of the replayed session, the editor's memory use at
+ * the end of it and the page faults taken up to the first frame and in
+ * all as one line of key=value pairs, and exit.
+ */
+[[noreturn]] static void replayFinish()
+{
+    std::vector<long long> lat = replay.latency_ns;
+    std::sort(lat.begin(), lat.end());
+    long long total = 0;
+    for (long long ns : lat)
+        total += ns;
+    auto pct = [&lat](int p) { return lat.empty() ? 0 : lat[(lat.size() - 1) * p / 100] / 1000; };
+
+    BoltMemory m = bolt->memory();
+    printf("events=%zu startup_us=%lld total_us=%lld mean_us=%lld p50_us=%lld p99_us=%lld max_us=%lld "
+           "idle_us=%lld output_bytes=%lld lines=%d",
+           lat.size(), replay.startup_ns / 1000, total / 1000, lat.empty() ? 0 : total / (long long)lat.size() / 1000,
+           pct(50), pct(99), lat.empty() ? 0 : lat.back() / 1000, replay.idle_ns / 1000, replay.output_bytes, bolt->lines());
+    printf(" mem_text=%lld mem_render=%lld mem_hl=%lld mem_rows=%lld mem_undo=%lld mem_index=%lld mem_cache=%lld "
+           "mem_total=%lld",
+           m.text, m.render, m.hl, m.rows, m.undo, m.index, m.cache,
+           m.text + m.render + m.hl + m.rows + m.undo + m.index + m.cache);
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf(" startup_minflt=%ld startup_majflt=%ld minflt=%ld majflt=%ld\n", replay.startup_minflt,
+           replay.startup_majflt, ru.ru_minflt, ru.ru_majflt);
+    std::exit(0);
 }
 
 /**
- * Append a C-string (null-terminated) to abuf 'ab'.
+ * Deliver the session's events as terminal input. Asked again before an
+ * event's frame is out, report one read timeout first, as a terminal
+ * would after a lone ESC.
  */
-static void abAppend(abuf &ab, const char *s)
+static ssize_t replayRead(unsigned char *buf, size_t len)
 {
-    ab.b.append(s);
-}
-
-/*** output ***/
-
-/**
- * Update E.rowoff and E.coloff so that E.cx and E.cy are within
- * the visible window on screen.
- */
-static void editorScroll()
-{
-    E.rx = 0;
-    if (E.cy < (int)E.rows.size())
-    {
-        E.rx = editorRowCxToRx(E.rows[E.cy], E.cx);
-    }
-
-    // Vertical scrolling
-    if (E.cy < E.rowoff)
+    if (replay.next > 0 && replay.pos < replay.events[replay.next - 1].bytes.size())
     {
-        E.rowoff = E.cy;
+        const std::string &bytes = replay.events[replay.next - 1].bytes;
+        size_t n = std::min(len, bytes.size() - replay.pos);
+        memcpy(buf, bytes.data() + replay.pos, n);
+        replay.pos += n;
+        return (ssize_t)n;
     }
-    if (E.cy >= E.rowoff + E.screenrows)
+    if (replay.waiting && !replay.timed_out)
     {
-        E.rowoff = E.cy - E.screenrows + 1;
+        replay.timed_out = true;
+        return 0;
     }
+    if (replay.next == replay.events.size())
+        replayFinish();
 
-    // Horizontal scrolling
-    if (E.rx < E.coloff)
-    {
-        E.coloff = E.rx;
-    }
-    if (E.rx >= E.coloff + E.screencols)
-    {
-        E.coloff = E.rx - E.screencols + 1;
-    }
+    long long now = nowNs();
+    if (!replay.waiting)
+        replay.idle_ns += now - replay.drawn;
+    replay.arrived = now;
+    replay.waiting = true;
+    replay.timed_out = false;
+    replay.next++;
+    replay.pos = 0;
+    return replayRead(buf, len);
 }
 
 /**
- * Draw the rows of text (or '~' / welcome message) for each row on screen.
+ * The next event is due once its gap has passed since the last frame.
  */
-static void editorDrawRows(abuf &ab)
+static bool replayPending()
 {
-    for (int y = 0; y < E.screenrows; y++)
-    {
-        int filerow = y + E.rowoff;
-        if (filerow >= (int)E.rows.size())
-        {
-            // Display welcome message or '~'
-            if (E.rows.empty() && y == E.screenrows / 3)
-            {
-                std::ostringstream ss;
-                ss << "Kilo editor -- version " << KILO_VERSION;
-                std::string welcome = ss.str();
-                if ((int)welcome.size() > E.screencols)
-                {
-                    welcome.resize(E.screencols);
-                }
-                int padding = (E.screencols - (int)welcome.size()) / 2;
-                if (padding)
-                {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while (padding-- > 0)
-                    abAppend(ab, " ", 1);
-                abAppend(ab, welcome.c_str(), (int)welcome.size());
-            }
-            else
-            {
-                abAppend(ab, "~", 1);
-            }
-        }
-        else
-        {
-            const ERow &row = E.rows[filerow];
-            int len = (int)row.render.size() - E.coloff;
-            if (len < 0)
-                len = 0;
-            if (len > E.screencols)
-                len = E.screencols;
-            
-            int current_color = -1;
-            for (int j = 0; j < len; j++){
-                char c = E.rows[filerow].render[E.coloff + j];
-                int hl = E.rows[filerow].hl[E.coloff + j];
-                if (hl == HL_NORMAL){
-                    if (current_color != -1){
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(ab, std::string(1, c).c_str(), 1);
-                } else {
-                    int color = editorSyntaxColor(hl);
-                    if (color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, std::string(1, c).c_str(), 1);
-                }
-            }
-            abAppend(ab, "\x1b[39m", 5);
-        }
-
-        // Clear to end of line
-        abAppend(ab, "\x1b[K", 3);
-        // Newline
-        abAppend(ab, "\r\n", 2);
-    }
+    return !replay.waiting && replay.next < replay.events.size() && nowNs() >= replay.due;
 }
 
 /**
- * Draw the status bar (filename, dirty status, line count, etc.).
+ * A frame is out: that ends the timing of the event that caused it.
  */
-static void editorDrawStatusBar(abuf &ab)
+static void replayWrite(const char *, size_t len)
 {
-    abAppend(ab, "\x1b[7m"); // Invert colors
-
-    // Left status
-    std::ostringstream leftStatus;
-    leftStatus << (E.filename.empty() ? "[No Name]" : E.filename)
-               << " - " << E.rows.size() << " lines"
-               << (E.dirty ? " (modified)" : "");
-
-    // Right status
-    std::ostringstream rightStatus;
-    rightStatus << (E.cy + 1) << "/" << E.rows.size();
-
-    std::string lStr = leftStatus.str();
-
-    rightStatus << (E.syntax ? E.syntax->filetype : "no ft")
-                << " | " << (E.cy + 1) << "/" << E.rows.size();
-
-    std::string rStr = rightStatus.str(); // Convert right status to a string
-
-    int len = static_cast<int>(lStr.size());
-    int rlen = static_cast<int>(rStr.size());
-
-    if (len > E.screencols)
+    long long now = nowNs();
+    replay.output_bytes += (long long)len;
+    if (replay.startup_ns < 0)
     {
-        lStr.resize(E.screencols);
-        len = E.screencols;
+        replay.startup_ns = now - replay.t0;
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        replay.startup_minflt = ru.ru_minflt;
+        replay.startup_majflt = ru.ru_majflt;
     }
-
-    abAppend(ab, lStr.c_str(), len);
-
-    // Fill the remainder of the screen with spaces,
-    // but place the rightStatus on the right side
-    while (len < E.screencols)
+    if (replay.waiting)
     {
-        if (E.screencols - len == rlen)
-        {
-            abAppend(ab, rStr.c_str(), rlen);
-            break;
-        }
-        else
-        {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+        replay.latency_ns.push_back(now - replay.arrived);
+        replay.waiting = false;
     }
-    abAppend(ab, "\x1b[m"); // End invert
-    abAppend(ab, "\r\n", 2);
-}
-
-/**
- * Draw the message bar (e.statusmsg) at the bottom.
- */
-static void editorDrawMessageBar(abuf &ab)
-{
-    abAppend(ab, "\x1b[K", 3); // clear line
-    if (!E.statusmsg.empty())
-    {
-        int msglen = (int)E.statusmsg.size();
-        if (msglen > E.screencols)
-            msglen = E.screencols;
-        if (time(nullptr) - E.statusmsg_time < 5)
-        {
-            abAppend(ab, E.statusmsg.c_str(), msglen);
-        }
-    }
-}
-
-/**
- * Refresh the screen: hide cursor, position cursor at top-left,
- * draw rows, status bar, and message bar, then move cursor
- * to the correct position and show it again.
- */
-void editorRefreshScreen()
-{
-    editorScroll();
-
-    abuf ab;
-    // Hide cursor
-    abAppend(ab, "\x1b[?25l");
-    // Move cursor to top-left
-    abAppend(ab, "\x1b[H");
-
-    // Draw text and bars
-    editorDrawRows(ab);
-    editorDrawStatusBar(ab);
-    editorDrawMessageBar(ab);
-
-    // Move cursor to correct position
-    char buf[32];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH",
-             (E.cy - E.rowoff) + 1,
-             (E.rx - E.coloff) + 1);
-    abAppend(ab, buf);
-
-    // Show cursor
-    abAppend(ab, "\x1b[?25h");
-
-    write(STDOUT_FILENO, ab.b.data(), ab.b.size());
+    replay.drawn = now;
+    if (replay.next < replay.events.size())
+        replay.due = now + replay.events[replay.next].gap_ms * 1000000LL;
 }
 
-/**
- * Set a timed status message (fades out after a few seconds).
- */
-void editorSetStatusMessage(const char *fmt, ...)
+static void replayQuit()
 {
-    char buf[80];
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(buf, sizeof(buf), fmt, ap);
-    va_end(ap);
-
-    E.statusmsg = buf;
-    E.statusmsg_time = time(nullptr);
+    replayFinish();
 }
 
-/*** input ***/
+static const BoltTerminal replayTerminal = {replayRead, replayPending, replayWrite, replayQuit};
 
-/**
- * Prompt the user for input in the status bar. The prompt must contain
- * a "%s" where we insert the user's input. Returns the input string,
- * or empty if the user cancels with ESC.
- */
-std::string editorPrompt(const std::string &prompt, void (*callback)(std::string &, int))
+/*** main ***/
+int main(int argc, char *argv[])
 {
-    std::string input;
-    while (true)
+    replay.t0 = replay.last_input = nowNs();
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++)
     {
-        // Build the status message: prompt + current input
-        char status[256];
-        snprintf(status, sizeof(status), prompt.c_str(), input.c_str());
-        editorSetStatusMessage("%s", status);
-        editorRefreshScreen();
-
-        int c = editorReadKey();
-        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
-        {
-            if (!input.empty())
-            {
-                input.pop_back();
-            }
-        }
-        else if (c == '\x1b')
-        {
-            editorSetStatusMessage("");
-            if (callback) callback(input, c);
-            return std::string();
-        }
-        else if (c == '\r')
+        std::string arg = argv[i];
+        if (arg == "--replay" && i + 1 < argc)
         {
-            if (!input.empty())
+            replay.active = true;
+            if (!replayLoad(argv[++i]))
             {
-                editorSetStatusMessage("");
-                if (callback) callback(input, c);
-                return input;
+                fprintf(stderr, "bolt: can't replay %s\n", argv[i]);
+                return 1;
             }
         }
-        else if (!iscntrl(c) && c < 128)
-        {
-            input.push_back((char)c);
-        }
-
-        if (callback) callback(input, c);
-    }
-}
-
-/**
- * Move the cursor in response to arrow keys, page keys, etc.
- */
-static void editorMoveCursor(int key)
-{
-    if (E.rows.empty())
-    {
-        // No lines, nothing to move over
-        return;
-    }
-    switch (key)
-    {
-    case ARROW_LEFT:
-        if (E.cx > 0)
-        {
-            E.cx--;
-        }
-        else if (E.cy > 0)
-        {
-            E.cy--;
-            E.cx = (int)E.rows[E.cy].chars.size();
-        }
-        break;
-    case ARROW_RIGHT:
-    {
-        int rowLen = (int)E.rows[E.cy].chars.size();
-        if (E.cx < rowLen)
-        {
-            E.cx++;
-        }
-        else if (E.cy < (int)E.rows.size() - 1)
-        {
-            E.cy++;
-            E.cx = 0;
-        }
-    }
-    break;
-    case ARROW_UP:
-        if (E.cy > 0)
-        {
-            E.cy--;
-        }
-        break;
-    case ARROW_DOWN:
-        if (E.cy < (int)E.rows.size() - 1)
-        {
-            E.cy++;
-        }
-        break;
-    default:
-        break;
-    }
-    // Clamp cursor x to the length of the current row
-    int rowlen = (int)E.rows[E.cy].chars.size();
-    if (E.cx > rowlen)
-    {
-        E.cx = rowlen;
-    }
-}
-
-/**
- * Process a single keypress from the user: inserts chars,
- * handles special commands, movement, etc.
- */
-static void editorProcessKeypress()
-{
-    static int quit_times = KILO_QUIT_TIMES;
-
-    int c = editorReadKey();
-    switch (c)
-    {
-    case '\r':
-        editorInsertNewline();
-        break;
-
-    case CTRL_KEY('q'):
-        if (E.dirty && quit_times > 0)
+        else if (arg == "--record" && i + 1 < argc)
         {
-            editorSetStatusMessage(
-                "WARNING!!! File has unsaved changes. "
-                "Press Ctrl-Q %d more times to quit.",
-                quit_times);
-            quit_times--;
-            return;
+            replay.record = fopen(argv[++i], "w");
+            if (!replay.record)
+                die(argv[i]);
         }
-        // Clear screen
-        write(STDOUT_FILENO, "\x1b[2J", 4);
-        write(STDOUT_FILENO, "\x1b[H", 3);
-        std::exit(0);
-        break;
-
-    case CTRL_KEY('s'):
-        editorSave();
-        break;
-
-    case HOME_KEY:
-        E.cx = 0;
-        break;
-    case END_KEY:
-        E.cx = (int)E.rows[E.cy].chars.size();
-        break;
-
-    case CTRL_KEY('f'):
-        editorFind();
-        break;
-
-    case BACKSPACE:
-    case CTRL_KEY('h'):
-    case DEL_KEY:
-        if (c == DEL_KEY)
+        else if (arg == "--startuptime" && i + 1 < argc)
         {
-            // By default, DEL key moves cursor right, then backspace.
-            // This is a design choice; you could move left.
-            editorMoveCursor(ARROW_RIGHT);
+            FILE *out = fopen(argv[++i], "w");
+            if (!out)
+                die(argv[i]);
+            struct timespec cpu;
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+            fprintf(out, "cpu time before main: %.3f ms\n", cpu.tv_sec * 1e3 + cpu.tv_nsec / 1e6);
+            boltProfileStart(out);
         }
-        editorDelChar();
-        break;
-
-    case PAGE_UP:
-    case PAGE_DOWN:
-    {
-        if (c == PAGE_UP)
+        else if (arg == "--size" && i + 1 < argc)
         {
-            E.cy = E.rowoff;
+            if (sscanf(argv[++i], "%dx%d", &replay.rows, &replay.cols) != 2 || replay.rows < 3 || replay.cols < 1)
+            {
+                fprintf(stderr, "bolt: --size wants ROWSxCOLS\n");
+                return 1;
+            }
         }
         else
         {
-            E.cy = E.rowoff + E.screenrows - 1;
-            if (E.cy > (int)E.rows.size())
-                E.cy = (int)E.rows.size();
-        }
-        int times = E.screenrows;
-        while (times--)
-        {
-            editorMoveCursor((c == PAGE_UP) ? ARROW_UP : ARROW_DOWN);
+            files.push_back(arg);
         }
     }
-    break;
-
-    case ARROW_UP:
-    case ARROW_DOWN:
-    case ARROW_LEFT:
-    case ARROW_RIGHT:
-        editorMoveCursor(c);
-        break;
-
-    case CTRL_KEY('l'):
-    case '\x1b':
-        // Do nothing
-        break;
-    
-    case ((int)'{'):
-        editorInsertChar((char)c);
-        editorInsertChar('}');
-        E.cx--;
-        break;
-    
-    case ((int)'('):
-        editorInsertChar((char)c);
-        editorInsertChar(')');
-        E.cx--;
-        break;
-
-    default:
-        // Insert normal character
-        editorInsertChar((char)c);
-        break;
-    }
-    // Reset quit_times if the user does anything else
-    quit_times = KILO_QUIT_TIMES;
-}
-
-/*** init ***/
-
-/**
- * Initialize the editor by reading the screen size and
- * resetting state variables.
- */
-static void initEditor()
-{
-    E.cx = 0;
-    E.cy = 0;
-    E.rx = 0;
-    E.rowoff = 0;
-    E.coloff = 0;
-    E.dirty = false;
-    E.filename.clear();
-    E.statusmsg.clear();
-    E.statusmsg_time = 0;
-    E.syntax = nullptr;
-
-    if (getWindowSize(E.screenrows, E.screencols) == -1)
+    boltProfilePhase("arguments");
+    bool piped = std::find(files.begin(), files.end(), "-") != files.end();
+    std::string piped_text;
+    if (piped)
     {
-        die("getWindowSize");
+        files.erase(std::remove(files.begin(), files.end(), "-"), files.end());
+        piped_text = editorReadStdin();
+        boltProfilePhase("read stdin");
     }
-    // Make room for status bar and message bar
-    E.screenrows -= 2;
-}
 
-/*** main ***/
-int main(int argc, char *argv[])
-{
-    enableRawMode();
-    initEditor();
-
-    if (argc >= 2)
+    int rows = replay.rows, cols = replay.cols;
+    if (!replay.active)
     {
-        editorOpen(argv[1]);
+        enableRawMode();
+        boltProfilePhase("raw mode");
+        if (getWindowSize(rows, cols) == -1)
+            die("getWindowSize");
+        boltProfilePhase("window size");
+        write(STDOUT_FILENO, BOLT_PROBE, sizeof(BOLT_PROBE) - 1);
+        boltProfilePhase("send probe");
     }
+    static BoltEditor editor(rows, cols, replay.active ? &replayTerminal : &tty);
+    bolt = &editor;
+    boltProfilePhase("core init");
 
-    editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find");
-
-    while (true)
+    editor.setStatus("HELP: Ctrl-S = save | Ctrl-Q = quit | Ctrl-F = find | Ctrl-O = open | Ctrl-N = next");
+    if (!piped || !files.empty())
+        editor.openFiles(files);
+    if (piped)
     {
-        editorRefreshScreen();
-        editorProcessKeypress();
+        editor.openErrors(piped_text);
+        boltProfilePhase("read errors");
     }
+    editor.loadConfig();
 
+    editor.run();
     return 0;
 }
@@ -0,0 +1,6469 @@
+
+#define _DEFAULT_SOURCE
+#define _BSD_SOURCE
+#ifndef _GNU_SOURCE // g++ already defines it
+#define _GNU_SOURCE
+#endif
+
+#include <cerrno>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cstdint>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BOLT_MULTIVERSION // Hot kernels get AVX2 versions, picked at load time
+#endif
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bolt_core.h"
+
+/*** defines ***/
+#define CTRL_KEY(k) ((k) & 0x1f)
+#define KILO_VERSION "0.0.1"
+#define KILO_TAB_STOP 8
+#define KILO_QUIT_TIMES 3
+#define BOLT_LOAD_CHUNK 4096
+#define BOLT_SESSION_FILE ".bolt_session"
+#define BOLT_RC_FILE ".boltrc"
+#define BOLT_WHEEL_ROWS 3
+#define BOLT_INDENT_SPACES 4 // Indent step for rows indented with spaces
+#define BOLT_PARALLEL_ROWS 4096 // Re-render larger batches on worker threads
+#define BOLT_PARALLEL_CHUNK 512 // Rows a worker takes from a batch at a time
+#define BOLT_UNDO_GROUPS 32
+#define BOLT_SAVE_IOV 1024 // iovecs per writev() call while saving
+#define BOLT_IO_BLOCK 65536 // Bytes per read() while loading, and per transcoded save chunk
+#define BOLT_MINIMAP_WIDTH 2 // Columns taken by the overview ruler: a marker and a shade
+#define BOLT_CACHE_BUDGET (64LL << 20) // Bytes of rendered rows kept across all buffers
+#define BOLT_PREFETCH_BYTES (4 << 20) // How far ahead of the loader the file is read in
+#define BOLT_HUGE_PAGE (2 << 20) // Transparent huge page size with 4K base pages
+#define BOLT_INDEX_BLOCK 64 // Rows per block of the offset and shade index
+
+enum editorKeys
+{
+    BACKSPACE = 127,
+    ARROW_LEFT = 1000,
+    ARROW_RIGHT,
+    ARROW_UP,
+    ARROW_DOWN,
+    DEL_KEY,
+    HOME_KEY,
+    END_KEY,
+    PAGE_UP,
+    PAGE_DOWN,
+    CTRL_ARROW_LEFT,
+    CTRL_ARROW_RIGHT,
+    CTRL_ARROW_UP,
+    CTRL_ARROW_DOWN,
+    SHIFT_ARROW_LEFT,
+    SHIFT_ARROW_RIGHT,
+    SHIFT_ARROW_UP,
+    SHIFT_ARROW_DOWN,
+    F1_KEY, // F1..F12 are consecutive
+    F12_KEY = F1_KEY + 11,
+    MOUSE_EVENT, // Details are in the last input event
+    FOCUS_IN,
+    FOCUS_OUT,
+    SHIFT_TAB,
+    KEY_COUNT // Number of key codes; keep last
+};
+
+enum editorHighlight {
+    HL_NORMAL = 0,
+    HL_COMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_STRING,
+    HL_NUMBER,
+    HL_MATCH
+};
+
+/*
+ * What the overview ruler counts for each row: non-blank characters, the
+ * characters of each highlight class it shades by, and whether the row
+ * has changed since the file was last saved (0 or 1).
+ */
+enum editorShade
+{
+    SHADE_TEXT = 0,
+    SHADE_COMMENT,
+    SHADE_KEYWORD,
+    SHADE_STRING,
+    SHADE_NUMBER,
+    SHADE_MODIFIED,
+    SHADE_COUNT
+};
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
+/*** data ***/
+
+struct editorSyntax
+{
+    std::string filetype;
+    std::vector<std::string> filematch;
+    int flags;
+};
+
+/*
+ * Each line of text is stored in an ERow.
+ *  - 'chars' holds the actual text of the line
+ *  - 'render' is an expanded version that replaces tabs with spaces
+ */
+struct ERow
+{
+    std::string chars;  // The actual text of the row
+    std::string render; // The rendered version (tabs expanded, etc.)
+    std::vector<int> hl;
+    std::vector<int> rx2cx; // render index -> chars index; empty when the row has no tabs
+    bool tabs = false;      // 'chars' has a tab
+    bool evicted = false;   // 'render', 'hl' and 'rx2cx' were dropped; see editorRowCached
+    bool referenced = false; // Read since the cache last swept past this row
+    long long cached = 0;   // Heap bytes of 'render', 'hl' and 'rx2cx' counted in the cache
+    int width = 0;          // Length of 'render' as of the last render
+    int indent_len = 0;     // Bytes of leading whitespace in 'chars'
+    int indent_width = 0;   // Rendered width of that whitespace
+    int bytes = 0;          // Length of 'chars' as of the last render
+    int words = 0;          // Whitespace-separated words in 'chars'
+    int glyphs = 0;         // UTF-8 code points in 'chars'
+    std::array<int, SHADE_COUNT> shade{}; // Overview ruler counts as of the last render
+};
+
+/*
+ * Buffer totals, kept up to date as rows change by subtracting a row's
+ * cached counts before it is re-rendered and adding them back after.
+ */
+struct editorStats
+{
+    long long bytes = 0; // Not counting newlines
+    long long words = 0;
+    long long chars = 0; // UTF-8 code points
+    std::map<int, int> widths; // Rendered row width -> number of rows
+};
+
+typedef std::array<long long, SHADE_COUNT> editorShadeCounts;
+
+/*
+ * Fenwick tree over a sequence: prefix sums and point updates in
+ * O(log n).
+ */
+struct editorFenwick
+{
+    std::vector<long long> tree; // 1-based
+};
+
+/*
+ * Index over the rows, in blocks of about BOLT_INDEX_BLOCK rows. Fenwick
+ * trees over the blocks' row counts, sizes (bytes plus the newline) and
+ * shade counts map between byte offsets and (row, col), and total the
+ * shades of any run of rows for the overview ruler, in
+ * O(log n + BOLT_INDEX_BLOCK). Inserting or deleting a row anywhere only
+ * changes its block's totals. A block that grows to twice the size is
+ * split, which rebuilds the trees over the blocks: O(n / BOLT_INDEX_BLOCK)
+ * once per BOLT_INDEX_BLOCK inserts or so. Shade counts are only kept
+ * once the ruler has been shown.
+ */
+struct editorRowIndex
+{
+    std::vector<long long> rows, bytes;                     // Per block
+    std::array<std::vector<long long>, SHADE_COUNT> shades; // Per block, while 'shaded'
+    editorFenwick rows_tree, bytes_tree;
+    std::array<editorFenwick, SHADE_COUNT> shade_trees;
+    bool valid = false;
+    bool shaded = false;
+};
+
+/*
+ * A position that stays attached to the text as rows and characters are
+ * inserted and deleted, such as a bookmark or a named mark. Anchors are
+ * kept in a treap ordered by (row, col). An edit shifts a whole run of
+ * anchors by splitting it off and tagging the root of that run with a
+ * pending delta, so it costs O(log n) however many anchors there are.
+ */
+struct editorAnchor
+{
+    int row = 0, col = 0;   // Exact once every ancestor's delta is pushed down
+    int drow = 0, dcol = 0; // Delta not yet applied to this node's children
+    unsigned prio = 0;
+    int left = -1, right = -1, parent = -1;
+};
+
+struct editorAnchors
+{
+    std::vector<editorAnchor> nodes; // Indexed by anchor id
+    std::vector<int> free_ids;
+    int root = -1;
+    int count = 0;
+    unsigned seed = 2463534242u; // xorshift state for node priorities
+};
+
+/*
+ * Incremental reader for a file that is still being loaded. Rows are
+ * pulled from 'file' in chunks, so the first screen can be drawn before
+ * the rest of a large file has been read.
+ */
+struct editorLoader
+{
+    int fd = -1;
+    bool active = false;   // True while there are rows left to read
+    bool detected = false; // The encoding has been chosen from the first block
+    std::string pending;   // Decoded (UTF-8) text not yet split into rows
+    size_t pos = 0;        // Start of the first unsplit line in 'pending'
+    std::string carry;     // Undecoded bytes split across a block boundary
+    off_t offset = 0;      // Bytes read from 'fd' so far
+    off_t prefetched = 0;  // End of the range last asked to be read ahead
+};
+
+/*
+ * On-disk encodings. Text is always held as UTF-8 internally and
+ * converted back to the file's encoding when saving.
+ */
+enum editorEncoding
+{
+    ENC_UTF8 = 0,
+    ENC_UTF16LE,
+    ENC_UTF16BE,
+    ENC_LATIN1,
+};
+
+/*
+ * Optional transforms applied to each row as the file is written.
+ */
+enum editorSaveTabs
+{
+    SAVE_TABS_KEEP = 0,
+    SAVE_TABS_EXPAND,   // Tabs become spaces (the rendered text)
+    SAVE_TABS_UNEXPAND, // Leading spaces become tabs
+};
+
+struct editorSaveOptions
+{
+    bool strip_trailing = false; // Drop trailing blanks
+    int tabs = SAVE_TABS_KEEP;
+    bool final_newline = true;   // Always end the file with a newline
+};
+
+/*
+ * Rows [first, first + before.size()) as they were before a region
+ * operation rewrote them, so the whole operation undoes in one step.
+ */
+struct editorUndoGroup
+{
+    int first;
+    std::vector<std::string> before;
+    int cx, cy;
+};
+
+/*
+ * The rows of a buffer whose derived data is held, in sweep order, and
+ * how many bytes that data takes.
+ */
+struct editorRowCache
+{
+    std::deque<int> ring; // Row indices, kept in step with inserts and deletes
+    long long bytes = 0;
+};
+
+/*
+ * Per-file state. The active buffer lives directly in E (editorConfig
+ * derives from editorBuffer); inactive buffers are parked in E.buffers
+ * and swapped in when switched to.
+ */
+struct editorBuffer
+{
+    int cx = 0, cy = 0;  // Cursor x (column) and y (row) position in the file
+    int rowoff = 0;      // Offset of the row displayed (top of the screen)
+    int coloff = 0;      // Offset of the column displayed (left of the screen)
+    bool dirty = false;  // Track if the file is modified
+    bool no_eol = false; // The file on disk didn't end with a newline
+    int encoding = ENC_UTF8;
+    bool bom = false;    // The file started with a byte order mark
+    std::string filename;
+    std::string path;    // 'filename' made absolute when it was set, to match locations against
+
+    // Selection between the anchor and the cursor, when active
+    bool sel_active = false;
+    int sel_cx = 0, sel_cy = 0;
+
+    editorStats stats;
+    editorRowIndex index;
+    std::vector<int> match_rows; // Rows matching the last search, for the overview ruler
+    std::string match_query;     // What match_rows holds the matches of while a search is typed
+    editorAnchors bookmarks;
+    editorAnchors marks;
+    std::map<char, int> mark_ids; // Mark name -> anchor id in 'marks'
+    bool errors_list = false; // This buffer's rows were parsed as locations
+
+    // Parsed locations in this file, kept in step with edits like marks:
+    // the anchor of each entry of E.errors (-1 for other files), and by
+    // anchor id, whether the location gave only a line
+    editorAnchors diagnostics;
+    std::vector<int> diagnostic_ids;
+    std::vector<bool> diagnostic_line;
+
+    // Region operations that can still be undone, oldest first. Any other
+    // edit clears this, since it may shift the rows the groups refer to.
+    std::vector<editorUndoGroup> undo;
+
+    struct EditorSyntax *syntax = nullptr;
+
+    // Each line in the file is stored in a vector of ERow
+    std::vector<ERow> rows;
+    editorLoader loader;
+    editorRowCache cache;
+};
+
+/*
+ * A "file:line:col:" location from compiler or grep output. 'row' is the
+ * row of the errors buffer it was parsed from.
+ */
+struct editorLocation
+{
+    std::string file;
+    std::string path; // 'file' made absolute, to match against the active buffer
+    int line, col;
+    int row;
+};
+
+/*
+ * The main editor configuration/state struct
+ */
+struct editorConfig : editorBuffer
+{
+    int rx = 0;             // Rendered x position (when we account for tabs, etc.)
+    int screenrows = 0;     // Number of rows we can display
+    int screencols = 0;     // Number of columns we can display
+    int scroll_pending = 0; // Wheel scroll (in rows) not yet applied to rowoff
+    bool mouse_dragging = false;
+    bool show_stats = false;   // Show buffer statistics in the message bar
+    bool show_minimap = false; // Show the overview ruler at the right edge
+    bool huge_pages = false;   // Back the row array with transparent huge pages
+    std::string statusmsg;
+    time_t statusmsg_time = 0;
+
+    // Open buffers other than the active one, in switching order
+    std::vector<editorBuffer> buffers;
+
+    // Auto-pairs for buffers without a filetype
+    std::array<char, 128> default_pair_close = {};
+
+    editorSaveOptions save_opts;
+    long long cache_budget = BOLT_CACHE_BUDGET; // For rendered rows in all buffers; 0 for no limit
+    ERow evict_scratch; // Buffers editorRenderRowEvicted renders rows past the budget into
+
+    // Locations parsed from compiler/grep output, and the current one
+    std::vector<struct editorLocation> errors;
+    int error_index = -1;
+
+    // Search in progress: the query and the match the cursor is on
+    std::string find_query;
+    int find_row = -1, find_col = 0;
+    int find_last_match = -1, find_direction = 1; // Where the next search step starts
+};
+
+/*** Editor state ***/
+
+/*
+ * Each BoltEditor owns its state (BoltEditorState, at the end of the
+ * file). A call into an editor binds that state to the calling thread,
+ * and the rest of the file reaches it through per-thread pointers like
+ * this one, so E is the config of whichever editor the thread is
+ * running. Editors on different threads never share any of it.
+ */
+static thread_local BoltEditorState *bound_state; // The editor this thread is running
+static thread_local editorConfig *bound_config;
+#define E (*bound_config)
+
+/*** filetype ***/
+struct EditorSyntax
+{
+    std::string filetype;                // File type name
+    std::vector<std::string> extensions; // File extensions
+    std::vector<std::string> keywords;
+    std::string singleline_comment_start;
+    int flags;                           // Syntax highlighting flags
+    std::string autopairs;               // Opening/closing chars inserted together, e.g. "{}()"
+    std::array<char, 128> pair_close{};  // Compiled from 'autopairs': opener -> closer
+};
+
+/*
+ * The built-in filetypes. Each editor works on its own copy, HLDB, so
+ * one editor's ~/.boltrc autopairs don't reach another.
+ */
+static const std::vector<EditorSyntax> HLDB_BUILTIN = {
+    {
+        "c",                  // File type
+        {".c", ".h", ".cpp"}, // Extensions
+        {
+            "switch", "if", "while", "for", "break", "continue", "return", "else",
+            "struct", "union", "typedef", "static", "enum", "class", "case",
+            "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+            "void|"},
+        "//",
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS, // Flags
+        "{}()"                                       // Auto-pairs
+    },
+};
+
+static thread_local std::vector<EditorSyntax> *bound_hldb;
+#define HLDB (*bound_hldb)
+
+/*** prototypes ***/
+static void editorSetStatusMessage(const char *fmt, ...);
+static void editorRefreshScreen();
+static std::string editorPrompt(const std::string &prompt, void (*callback)(std::string &, int));
+static bool editorIdlePending();
+static void editorEnsureRows(size_t n);
+static std::string editorAbsolutePath(const std::string &filename);
+static void editorSetFilename(const std::string &filename);
+static void editorIdleWork();
+static void editorBind(BoltEditorState *s);
+
+/*** startup profile ***/
+
+// Set from boltProfileStart() until the first frame drawn on the same
+// thread, so the phases of one editor's startup aren't mixed with another's
+static thread_local FILE *profile_out;
+static thread_local long long profile_start, profile_last;
+
+static long long editorClockNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void boltProfileStart(FILE *out)
+{
+    profile_out = out;
+    profile_start = profile_last = editorClockNs();
+    fprintf(out, "times in ms\n   clock     self  phase\n");
+}
+
+void boltProfilePhase(const char *name)
+{
+    if (!profile_out)
+        return;
+    long long now = editorClockNs();
+    fprintf(profile_out, "%8.3f %8.3f  %s\n", (now - profile_start) / 1e6, (now - profile_last) / 1e6, name);
+    profile_last = now;
+}
+
+/*** terminal ***/
+
+// The front end's terminal, or nullptr for a headless editor
+static thread_local const BoltTerminal **bound_term;
+#define term (*bound_term)
+
+/**
+ * Print an error message (via perror) and exit.
+ * Also reset the screen so it isn't left in a weird state.
+ */
+static void die(const char *s)
+{
+    // Clear screen and position cursor at home
+    if (term)
+        term->write("\x1b[2J\x1b[H", 7);
+
+    perror(s);
+    std::exit(1);
+}
+
+/*
+ * What the terminal reported about itself in reply to BOLT_PROBE. The
+ * replies come back through the input
+ * parser whenever they arrive, so startup never waits for them; until
+ * then frames are drawn with only VT100 sequences.
+ */
+struct editorTermCaps
+{
+    bool answered = false; // The primary DA reply has arrived
+    int da1_level = 0;     // 1 for VT100, 62-65 for VT220 to VT525
+    int da2_type = -1, da2_version = -1;
+    std::string version;   // XTVERSION, e.g. "XTerm(390)"
+    bool ech = false;      // Erase Character (CSI X)
+    bool rep = false;      // Repeat the preceding character (CSI b)
+    bool sync = false;     // Synchronized output (mode 2026)
+};
+
+static thread_local editorTermCaps *bound_termcaps;
+#define termcaps (*bound_termcaps)
+
+/**
+ * Handle the primary DA reply, after which every other reply is in.
+ * ECH is part of VT220. REP is only trusted from terminals known to
+ * implement it, since others print nothing for it.
+ */
+static void editorTermDA1(const int *params, int nparams)
+{
+    static const char *rep_terminals[] = {"XTerm", "foot", "kitty", "WezTerm", "tmux"};
+    termcaps.answered = true;
+    termcaps.da1_level = nparams > 0 ? params[0] : 1;
+    termcaps.ech = termcaps.da1_level >= 62;
+    for (const char *name : rep_terminals)
+    {
+        if (termcaps.version.compare(0, strlen(name), name) == 0)
+            termcaps.rep = true;
+    }
+}
+
+/*** input parsing ***/
+
+/*
+ * Terminal input is decoded by a table-driven VT parser. Bytes are read
+ * from stdin in batches and fed through 'input_table', which maps
+ * (state, byte) to an action and the next state. Parser state survives
+ * between reads, so a sequence split across two reads still decodes, and
+ * a lone ESC is only reported once a read times out with nothing after it.
+ */
+enum editorInputState
+{
+    IN_GROUND = 0,
+    IN_ESCAPE,     // After ESC
+    IN_CSI,        // After ESC [
+    IN_SS3,        // After ESC O
+    IN_STRING,     // Inside DCS/OSC/APC/PM, collected up to ST or BEL
+    IN_STRING_ESC, // ESC seen inside a string, maybe the start of ST
+    IN_STATE_COUNT
+};
+
+enum editorInputAction
+{
+    IA_NONE = 0,
+    IA_KEY,       // Emit the byte as a key
+    IA_CLEAR,     // Start a new sequence
+    IA_PARAM,     // Accumulate a parameter digit
+    IA_SEP,       // Move on to the next parameter
+    IA_PREFIX,    // Private marker such as '<' or '?'
+    IA_CSI,       // Dispatch a complete CSI sequence
+    IA_SS3,       // Dispatch a complete SS3 sequence
+    IA_ESC_KEY,   // ESC followed by an ordinary byte: emit ESC, then the byte
+    IA_ESC_AGAIN, // ESC ESC: emit the first ESC, stay in escape
+    IA_INTERMEDIATE, // CSI intermediate byte such as '$'
+    IA_STRING_START, // ESC P, ESC ], ESC ^ or ESC _
+    IA_STRING_BYTE,  // Collect a byte of the string
+    IA_STRING_END,   // Dispatch a complete string
+};
+
+#define INPUT_MAX_PARAMS 8
+#define INPUT_MAX_STRING 256
+
+struct editorInputEvent
+{
+    int key;
+    int mouse_button; // SGR button code, including modifier and motion bits
+    int mouse_x;      // 0-based screen column
+    int mouse_y;      // 0-based screen row
+    bool mouse_press; // false for a release
+};
+
+struct editorInput
+{
+    int state = IN_GROUND;
+    int params[INPUT_MAX_PARAMS] = {};
+    int nparams = 0;
+    char prefix = 0;
+    char intermediate = 0;
+    char string_kind = 0;      // 'P' for DCS, ']' for OSC, ...
+    std::string string;        // Body of the string being collected
+    std::deque<editorInputEvent> events; // Decoded, not yet consumed
+    editorInputEvent last;                // The event most recently returned
+};
+
+static thread_local editorInput *bound_input;
+#define input (*bound_input)
+static unsigned char input_table[IN_STATE_COUNT][256];
+
+#define INPUT_ENTRY(action, state) (unsigned char)(((action) << 4) | (state))
+
+static void editorInputFill(int state, int from, int to, int action, int next)
+{
+    for (int c = from; c <= to; c++)
+        input_table[state][c] = INPUT_ENTRY(action, next);
+}
+
+/**
+ * Build the transition table. Called once at startup.
+ */
+static void editorInitInputTable()
+{
+    editorInputFill(IN_GROUND, 0, 255, IA_KEY, IN_GROUND);
+    editorInputFill(IN_GROUND, 0x1b, 0x1b, IA_CLEAR, IN_ESCAPE);
+
+    editorInputFill(IN_ESCAPE, 0, 255, IA_ESC_KEY, IN_GROUND);
+    editorInputFill(IN_ESCAPE, 0x1b, 0x1b, IA_ESC_AGAIN, IN_ESCAPE);
+    editorInputFill(IN_ESCAPE, '[', '[', IA_CLEAR, IN_CSI);
+    editorInputFill(IN_ESCAPE, 'O', 'O', IA_CLEAR, IN_SS3);
+    editorInputFill(IN_ESCAPE, 'P', 'P', IA_STRING_START, IN_STRING);
+    editorInputFill(IN_ESCAPE, ']', ']', IA_STRING_START, IN_STRING);
+    editorInputFill(IN_ESCAPE, '^', '_', IA_STRING_START, IN_STRING);
+
+    editorInputFill(IN_CSI, 0, 255, IA_NONE, IN_CSI);
+    editorInputFill(IN_CSI, '0', '9', IA_PARAM, IN_CSI);
+    editorInputFill(IN_CSI, ':', ';', IA_SEP, IN_CSI);
+    editorInputFill(IN_CSI, '<', '?', IA_PREFIX, IN_CSI);
+    editorInputFill(IN_CSI, 0x20, 0x2f, IA_INTERMEDIATE, IN_CSI);
+    editorInputFill(IN_CSI, 0x40, 0x7e, IA_CSI, IN_GROUND);
+    editorInputFill(IN_CSI, 0x1b, 0x1b, IA_CLEAR, IN_ESCAPE);
+
+    editorInputFill(IN_SS3, 0, 255, IA_NONE, IN_GROUND);
+    editorInputFill(IN_SS3, 0x40, 0x7e, IA_SS3, IN_GROUND);
+    editorInputFill(IN_SS3, 0x1b, 0x1b, IA_CLEAR, IN_ESCAPE);
+
+    editorInputFill(IN_STRING, 0, 255, IA_STRING_BYTE, IN_STRING);
+    editorInputFill(IN_STRING, 0x07, 0x07, IA_STRING_END, IN_GROUND);
+    editorInputFill(IN_STRING, 0x1b, 0x1b, IA_NONE, IN_STRING_ESC);
+    editorInputFill(IN_STRING_ESC, 0, 255, IA_NONE, IN_STRING);
+    editorInputFill(IN_STRING_ESC, '\\', '\\', IA_STRING_END, IN_GROUND);
+}
+
+static void editorInputEmit(int key)
+{
+    input.events.push_back({key, 0, 0, 0, false});
+}
+
+/**
+ * Apply an xterm modifier parameter (2 = Shift, 5 = Ctrl, ...) to an
+ * arrow key. Modifiers we have no key code for are dropped.
+ */
+static int editorInputModifyArrow(int key, int modifier)
+{
+    int mods = modifier - 1;
+    if (mods & 4)
+        return CTRL_ARROW_LEFT + (key - ARROW_LEFT);
+    if (mods & 1)
+        return SHIFT_ARROW_LEFT + (key - ARROW_LEFT);
+    return key;
+}
+
+static int editorInputFinalKey(char final)
+{
+    switch (final)
+    {
+    case 'A':
+        return ARROW_UP;
+    case 'B':
+        return ARROW_DOWN;
+    case 'C':
+        return ARROW_RIGHT;
+    case 'D':
+        return ARROW_LEFT;
+    case 'H':
+        return HOME_KEY;
+    case 'F':
+        return END_KEY;
+    case 'Z':
+        return SHIFT_TAB;
+    case 'P':
+    case 'Q':
+    case 'R':
+    case 'S':
+        return F1_KEY + (final - 'P');
+    }
+    return -1;
+}
+
+static int editorInputTildeKey(int code)
+{
+    switch (code)
+    {
+    case 1:
+    case 7:
+        return HOME_KEY;
+    case 3:
+        return DEL_KEY;
+    case 4:
+    case 8:
+        return END_KEY;
+    case 5:
+        return PAGE_UP;
+    case 6:
+        return PAGE_DOWN;
+    case 11:
+    case 12:
+    case 13:
+    case 14:
+    case 15:
+        return F1_KEY + (code - 11);
+    case 17:
+    case 18:
+    case 19:
+    case 20:
+    case 21:
+        return F1_KEY + 5 + (code - 17);
+    case 23:
+    case 24:
+        return F1_KEY + 10 + (code - 23);
+    }
+    return -1;
+}
+
+static void editorInputDispatchCsi(char final)
+{
+    int p0 = input.nparams > 0 ? input.params[0] : 0;
+    int p1 = input.nparams > 1 ? input.params[1] : 1;
+
+    if (input.prefix == '<' && (final == 'M' || final == 'm') && input.nparams >= 3)
+    {
+        // SGR mouse report: button;column;row, 1-based
+        input.events.push_back({MOUSE_EVENT, input.params[0], input.params[1] - 1,
+                                input.params[2] - 1, final == 'M'});
+        return;
+    }
+    if (input.prefix == '?' && final == 'c')
+    {
+        editorTermDA1(input.params, input.nparams);
+        return;
+    }
+    if (input.prefix == '>' && final == 'c')
+    {
+        termcaps.da2_type = p0;
+        termcaps.da2_version = input.nparams > 1 ? input.params[1] : 0;
+        return;
+    }
+    if (input.prefix == '?' && input.intermediate == '$' && final == 'y' && input.nparams >= 2)
+    {
+        // DECRPM: mode;state, where 1 and 2 mean the mode is known
+        if (input.params[0] == 2026)
+            termcaps.sync = input.params[1] == 1 || input.params[1] == 2;
+        return;
+    }
+    if (input.prefix || input.intermediate)
+        return; // Other private sequences
+
+    if (final == '~')
+    {
+        int key = editorInputTildeKey(p0);
+        if (key != -1)
+            editorInputEmit(key);
+    }
+    else if (final == 'I' && input.nparams == 0)
+    {
+        editorInputEmit(FOCUS_IN);
+    }
+    else if (final == 'O' && input.nparams == 0)
+    {
+        editorInputEmit(FOCUS_OUT);
+    }
+    else
+    {
+        int key = editorInputFinalKey(final);
+        if (key >= ARROW_LEFT && key <= ARROW_DOWN)
+            key = editorInputModifyArrow(key, p1);
+        if (key != -1)
+            editorInputEmit(key);
+    }
+}
+
+/**
+ * Run 'len' bytes through the parser, queueing any complete key events.
+ * Incomplete sequences are carried over to the next call.
+ */
+static void editorInputFeed(const unsigned char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = buf[i];
+        unsigned char entry = input_table[input.state][c];
+        input.state = entry & 0x0f;
+
+        switch (entry >> 4)
+        {
+        case IA_KEY:
+            editorInputEmit(c);
+            break;
+        case IA_CLEAR:
+            input.nparams = 0;
+            input.prefix = 0;
+            input.intermediate = 0;
+            break;
+        case IA_PARAM:
+            if (input.nparams == 0)
+                input.params[input.nparams++] = 0;
+            if (input.params[input.nparams - 1] < 100000)
+                input.params[input.nparams - 1] = input.params[input.nparams - 1] * 10 + (c - '0');
+            break;
+        case IA_SEP:
+            if (input.nparams == 0)
+                input.params[input.nparams++] = 0;
+            if (input.nparams < INPUT_MAX_PARAMS)
+                input.params[input.nparams++] = 0;
+            break;
+        case IA_PREFIX:
+            input.prefix = (char)c;
+            break;
+        case IA_CSI:
+            editorInputDispatchCsi((char)c);
+            break;
+        case IA_SS3:
+        {
+            int key = editorInputFinalKey((char)c);
+            if (key != -1)
+                editorInputEmit(key);
+            break;
+        }
+        case IA_ESC_KEY:
+            // A lone ESC followed by typing: keep both instead of eating the byte
+            editorInputEmit('\x1b');
+            i--;
+            break;
+        case IA_ESC_AGAIN:
+            editorInputEmit('\x1b');
+            break;
+        case IA_INTERMEDIATE:
+            input.intermediate = (char)c;
+            break;
+        case IA_STRING_START:
+            input.string_kind = (char)c;
+            input.string.clear();
+            break;
+        case IA_STRING_BYTE:
+            if (input.string.size() < INPUT_MAX_STRING)
+                input.string += (char)c;
+            break;
+        case IA_STRING_END:
+            // XTVERSION reply: DCS > | name(version) ST
+            if (input.string_kind == 'P' && input.string.compare(0, 2, ">|") == 0)
+                termcaps.version = input.string.substr(2);
+            break;
+        }
+    }
+}
+
+/**
+ * Called when a read times out. A pending ESC was a real keypress; any
+ * other half-finished sequence is dropped.
+ */
+static void editorInputTimeout()
+{
+    if (input.state == IN_ESCAPE)
+        editorInputEmit('\x1b');
+    input.state = IN_GROUND;
+}
+
+/**
+ * Return the next key, reading and decoding more input as needed.
+ */
+static int editorReadKey()
+{
+    while (input.events.empty())
+    {
+        // Headless: whatever is waiting for more input gets ESC instead
+        if (!term)
+            return '\x1b';
+
+        // Stream in pending file data for as long as the user is idle.
+        while (editorIdlePending() && !term->pending())
+            editorIdleWork();
+
+        unsigned char buf[256];
+        ssize_t nread = term->read(buf, sizeof(buf));
+        if (nread == -1 && errno != EAGAIN)
+            die("read");
+        if (nread <= 0)
+        {
+            editorInputTimeout();
+            continue;
+        }
+        editorInputFeed(buf, (size_t)nread);
+    }
+
+    input.last = input.events.front();
+    input.events.pop_front();
+    return input.last.key;
+}
+
+/**
+ * True if more input is ready without blocking, so the caller can keep
+ * handling events before drawing the next frame.
+ */
+static bool editorInputPending()
+{
+    return !input.events.empty() || (term && term->pending());
+}
+
+/*** syntax highlighting ***/
+
+static int is_separator(int c)
+{
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+static void editorUpdateSyntax(ERow &row)
+{
+    // Initialize all characters to normal highlighting.
+    row.hl.assign(row.render.size(), HL_NORMAL);
+
+    // Get the list of keywords from the currently selected syntax.
+    std::vector<std::string> keywords;
+    if (E.syntax)
+    {
+        keywords = E.syntax->keywords;
+    }
+
+    int prev_sep = 1;  // True if the previous character is a separator.
+    int in_string = 0; // 0 means not in a string; otherwise holds the quote char.
+    size_t i = 0;
+    while (i < row.render.size())
+    {
+        // Handle single-line comments.
+        if (E.syntax && !E.syntax->singleline_comment_start.empty() && !in_string)
+        {
+            const std::string &comment_start = E.syntax->singleline_comment_start;
+            if (i + comment_start.size() <= row.render.size() &&
+                row.render.substr(i, comment_start.size()) == comment_start)
+            {
+                std::fill(row.hl.begin() + i, row.hl.end(), HL_COMMENT);
+                break;
+            }
+        }
+
+        char c = row.render[i];
+        unsigned char prev_hl = (i > 0) ? row.hl[i - 1] : HL_NORMAL;
+
+        // Handle strings.
+        if (in_string)
+        {
+            row.hl[i] = HL_STRING;
+            if (c == in_string)
+                in_string = 0;
+            i++;
+            prev_sep = 1;
+            continue;
+        }
+        else
+        {
+            if (c == '"' || c == '\'')
+            {
+                in_string = c;
+                row.hl[i] = HL_STRING;
+                i++;
+                continue;
+            }
+        }
+
+        // Handle numbers.
+        if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+            (c == '.' && prev_hl == HL_NUMBER))
+        {
+            row.hl[i] = HL_NUMBER;
+            i++;
+            prev_sep = 0;
+            continue;
+        }
+
+        // Handle keywords.
+        // Only check for a keyword match if the previous character was a separator.
+        bool matched = false;
+        if (prev_sep)
+        {
+            for (const auto &kw : keywords)
+            {
+                // Copy the keyword; if it ends with a '|' then remove it and use a different color.
+                std::string key = kw;
+                int kw_color = HL_KEYWORD1;
+                if (!key.empty() && key.back() == '|')
+                {
+                    key.pop_back();
+                    kw_color = HL_KEYWORD2;
+                }
+                size_t klen = key.size();
+                // Check if the current substring matches the keyword, and ensure that the character
+                // after the keyword is a separator (or the end of the line).
+                if (i + klen <= row.render.size() &&
+                    row.render.compare(i, klen, key) == 0 &&
+                    (i + klen == row.render.size() || is_separator(row.render[i + klen])))
+                {
+                    std::fill(row.hl.begin() + i, row.hl.begin() + i + klen, kw_color);
+                    i += klen;
+                    matched = true;
+                    break;
+                }
+            }
+        }
+        if (matched)
+        {
+            prev_sep = 0;
+            continue;
+        }
+
+        // Update the "previous separator" status and move to the next character.
+        prev_sep = is_separator(c);
+        i++;
+    }
+}
+
+static void editorSelectSyntaxHighlight()
+{
+    E.syntax = nullptr; // Reset any previously selected syntax
+
+    if (E.filename.empty())
+        return;
+
+    // Find the last '.' in the filename to extract the extension.
+    size_t dot = E.filename.find_last_of('.');
+    if (dot == std::string::npos)
+        return;
+
+    std::string file_ext = E.filename.substr(dot);
+
+    for (auto &syntax : HLDB)
+    {
+        for (const auto &ext : syntax.extensions)
+        {
+            if (file_ext == ext)
+            {
+                E.syntax = &syntax;
+                return;
+            }
+        }
+    }
+}
+
+/*** row operations ***/
+
+/**
+ * Given a cursor x position (E.cx) in 'row->chars', this computes the
+ * corresponding x position in the rendered version (row->render),
+ * which accounts for tabs.
+ */
+static int editorRowCxToRx(const ERow &row, int cx)
+{
+    if (!row.tabs)
+        return cx; // No tabs, so render and chars line up
+    int rx = 0;
+    for (int j = 0; j < cx; j++)
+    {
+        if (row.chars[j] == '\t')
+        {
+            rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+        }
+        rx++;
+    }
+    return rx;
+}
+
+/**
+ * The inverse of editorRowCxToRx: map a rendered column back to a
+ * position in 'row.chars', using the table built by editorUpdateRow.
+ * Columns past the end of the row map to the end of the row.
+ */
+static int editorRowRxToCx(const ERow &row, int rx)
+{
+    if (rx < 0)
+        return 0;
+    if (rx >= row.width)
+        return (int)row.chars.size();
+    return row.tabs ? row.rx2cx[rx] : rx;
+}
+
+/**
+ * Build the 'render' string from 'chars' by expanding tabs into
+ * the appropriate number of spaces. Rows containing tabs also get
+ * an rx -> cx table so screen positions map back in O(1). Only
+ * touches 'row', so it is safe to run on several rows at once.
+ */
+static void editorRenderRow(ERow &row)
+{
+    row.render.clear();
+    row.rx2cx.clear();
+    bool has_tabs = row.chars.find('\t') != std::string::npos;
+    row.tabs = has_tabs;
+    row.evicted = false;
+
+    int words = 0, glyphs = 0;
+    bool in_word = false;
+    for (size_t cx = 0; cx < row.chars.size(); cx++)
+    {
+        char c = row.chars[cx];
+        if (c == '\t')
+        {
+            // Insert at least one space, then pad to the next tab stop
+            do
+            {
+                row.render += ' ';
+            } while (row.render.size() % KILO_TAB_STOP != 0);
+        }
+        else
+        {
+            row.render += c;
+        }
+        if (has_tabs)
+            row.rx2cx.resize(row.render.size(), (int)cx);
+
+        bool space = c == ' ' || c == '\t';
+        words += !space && !in_word;
+        in_word = !space;
+        glyphs += ((unsigned char)c & 0xC0) != 0x80;
+    }
+    row.bytes = (int)row.chars.size();
+    row.width = (int)row.render.size();
+    row.words = words;
+    row.glyphs = glyphs;
+
+    row.indent_len = (int)row.chars.find_first_not_of(" \t");
+    if (row.indent_len < 0)
+        row.indent_len = (int)row.chars.size();
+    row.indent_width = editorRowCxToRx(row, row.indent_len);
+
+    editorUpdateSyntax(row);
+
+    // Shade counts; SHADE_MODIFIED is left to the caller
+    static const int slot[] = {-1, SHADE_COMMENT, SHADE_KEYWORD, SHADE_KEYWORD, SHADE_STRING, SHADE_NUMBER, -1};
+    std::fill(row.shade.begin(), row.shade.begin() + SHADE_MODIFIED, 0);
+    for (size_t i = 0; i < row.render.size(); i++)
+    {
+        if (row.render[i] == ' ')
+            continue;
+        row.shade[SHADE_TEXT]++;
+        if (slot[row.hl[i]] >= 0)
+            row.shade[slot[row.hl[i]]]++;
+    }
+}
+
+/*** row cache ***/
+
+/*
+ * A row's 'render', 'hl' and 'rx2cx' can all be rebuilt from 'chars', so
+ * they are kept as a cache under one budget across all open buffers
+ * (set cache-budget). A row joins its buffer's ring when it is rendered.
+ * Once the total is over budget the rings are swept CLOCK-style: a row
+ * read since the last sweep gets a second chance, any other drops its
+ * derived data and is rendered again the next time it is read. The row
+ * text and its counts are never dropped.
+ *
+ * Ring entries are row indices, shifted when a row is inserted or
+ * deleted before them, so each names the row it was added for. Rows
+ * the loader appends shift nothing. A sweep that runs out of entries
+ * while still over budget rebuilds the ring from the rows.
+ */
+
+static long long editorHeapBytes(const std::string &s)
+{
+    // Short strings live inside the object itself
+    static const size_t inline_capacity = std::string().capacity();
+    return s.capacity() > inline_capacity ? (long long)s.capacity() + 1 : 0;
+}
+
+static long long editorRowCacheBytes(const ERow &row)
+{
+    return editorHeapBytes(row.render) + (long long)((row.hl.capacity() + row.rx2cx.capacity()) * sizeof(int));
+}
+
+/**
+ * Count row 'at' of E.rows against the cache after it was rendered.
+ */
+static void editorCacheCharge(int at)
+{
+    ERow &row = E.rows[at];
+    long long bytes = editorRowCacheBytes(row);
+    if (row.cached == 0 && bytes > 0)
+        E.cache.ring.push_back(at);
+    E.cache.bytes += bytes - row.cached;
+    row.cached = bytes;
+}
+
+/**
+ * Move the ring's entries for rows at or after 'at' by 'delta': +1 for
+ * a row inserted at 'at', -1 for the row at 'at' deleted, whose own
+ * entry is dropped.
+ */
+static void editorCacheShift(int at, int delta)
+{
+    std::deque<int> &ring = E.cache.ring;
+    if (delta < 0)
+        ring.erase(std::remove(ring.begin(), ring.end(), at), ring.end());
+    for (int &i : ring)
+    {
+        if (i >= at)
+            i += delta;
+    }
+}
+
+/**
+ * Bytes of derived data held across all open buffers.
+ */
+static long long editorCacheTotal()
+{
+    long long total = E.cache.bytes;
+    for (const editorBuffer &b : E.buffers)
+        total += b.cache.bytes;
+    return total;
+}
+
+/**
+ * Render 'row' for its counts only, leaving it evicted. One set of
+ * buffers is reused for every such row, so loading past the budget
+ * doesn't allocate and free the derived data of each row it reads.
+ */
+static void editorRenderRowEvicted(ERow &row)
+{
+    ERow &scratch = E.evict_scratch;
+    row.render.swap(scratch.render);
+    row.hl.swap(scratch.hl);
+    row.rx2cx.swap(scratch.rx2cx);
+    editorRenderRow(row);
+    row.render.swap(scratch.render);
+    row.hl.swap(scratch.hl);
+    row.rx2cx.swap(scratch.rx2cx);
+    row.evicted = true;
+}
+
+/**
+ * Row 'at' of E.rows with its derived data, rendered again if it was
+ * evicted. Everything that reads 'render', 'hl' or 'rx2cx' goes through
+ * here; the reference is good until the next editorCacheTrim.
+ */
+static ERow &editorRowCached(int at)
+{
+    ERow &row = E.rows[at];
+    if (row.evicted)
+    {
+        editorRenderRow(row); // Same counts as before, so nothing to re-account
+        editorCacheCharge(at);
+    }
+    row.referenced = true;
+    return row;
+}
+
+/**
+ * Sweep buffer 'b' until its rows hold at most 'target' bytes of derived
+ * data, or none of it is left to drop.
+ */
+static void editorCacheSweep(editorBuffer &b, long long target)
+{
+    editorRowCache &c = b.cache;
+    bool rebuilt = false;
+    while (c.bytes > target)
+    {
+        if (c.ring.empty())
+        {
+            if (rebuilt)
+                break;
+            for (size_t i = 0; i < b.rows.size(); i++)
+            {
+                if (b.rows[i].cached > 0)
+                    c.ring.push_back((int)i);
+            }
+            rebuilt = true;
+            continue;
+        }
+
+        int at = c.ring.front();
+        c.ring.pop_front();
+        if (at >= (int)b.rows.size() || b.rows[at].cached == 0)
+            continue; // Already dropped, or the row is gone
+
+        ERow &row = b.rows[at];
+        if (row.referenced)
+        {
+            row.referenced = false;
+            c.ring.push_back(at);
+            continue;
+        }
+        std::string().swap(row.render);
+        std::vector<int>().swap(row.hl);
+        std::vector<int>().swap(row.rx2cx);
+        row.evicted = true;
+        c.bytes -= row.cached;
+        row.cached = 0;
+    }
+}
+
+/**
+ * Bring the derived data of all open buffers back under the budget,
+ * taking it from the parked buffers first. Called between frames and
+ * load chunks, when nothing holds a reference into a row.
+ */
+static void editorCacheTrim()
+{
+    if (E.cache_budget <= 0)
+        return;
+    long long total = editorCacheTotal();
+
+    for (editorBuffer &b : E.buffers)
+    {
+        if (total <= E.cache_budget)
+            return;
+        long long before = b.cache.bytes;
+        editorCacheSweep(b, std::max(0LL, before - (total - E.cache_budget)));
+        total -= before - b.cache.bytes;
+    }
+    if (total > E.cache_budget)
+        editorCacheSweep(E, E.cache.bytes - (total - E.cache_budget));
+}
+
+/*** row index ***/
+
+static long long editorFenwickPrefix(const editorFenwick &f, size_t n)
+{
+    long long sum = 0;
+    for (size_t i = n; i > 0; i -= i & (~i + 1))
+        sum += f.tree[i];
+    return sum;
+}
+
+static void editorFenwickBuild(editorFenwick &f, const std::vector<long long> &values)
+{
+    std::vector<long long> &t = f.tree;
+    size_t n = values.size();
+    t.assign(n + 1, 0);
+    for (size_t i = 1; i <= n; i++)
+    {
+        t[i] += values[i - 1];
+        size_t j = i + (i & (~i + 1));
+        if (j <= n)
+            t[j] += t[i];
+    }
+}
+
+static void editorFenwickAdd(editorFenwick &f, size_t at, long long delta)
+{
+    std::vector<long long> &t = f.tree;
+    for (size_t i = at + 1; i < t.size(); i += i & (~i + 1))
+        t[i] += delta;
+}
+
+/**
+ * Append a value. The new node covers (i - lowbit(i), i], so it is
+ * worked out from two prefixes.
+ */
+static void editorFenwickPush(editorFenwick &f, long long value)
+{
+    size_t i = f.tree.size();
+    f.tree.push_back(value + editorFenwickPrefix(f, i - 1) - editorFenwickPrefix(f, i - (i & (~i + 1))));
+}
+
+/**
+ * Largest 'pos' with prefix(pos) <= 'x', by binary lifting. 'x' is left
+ * holding what is over that prefix.
+ */
+static size_t editorFenwickSearch(const editorFenwick &f, long long &x)
+{
+    const std::vector<long long> &t = f.tree;
+    size_t n = t.size() - 1;
+    size_t pos = 0;
+    size_t step = 1;
+    while (step * 2 <= n)
+        step *= 2;
+    for (; step > 0; step /= 2)
+    {
+        if (pos + step <= n && t[pos + step] <= x)
+        {
+            pos += step;
+            x -= t[pos];
+        }
+    }
+    return pos;
+}
+
+/**
+ * Build the trees over the blocks from their totals.
+ */
+static void editorIndexTrees()
+{
+    editorRowIndex &ix = E.index;
+    editorFenwickBuild(ix.rows_tree, ix.rows);
+    editorFenwickBuild(ix.bytes_tree, ix.bytes);
+    for (int k = 0; k < SHADE_COUNT; k++)
+        editorFenwickBuild(ix.shade_trees[k], ix.shades[k]);
+}
+
+/**
+ * Index the rows in blocks of BOLT_INDEX_BLOCK, with their shade counts
+ * if 'shaded'.
+ */
+static void editorIndexBuild(bool shaded)
+{
+    editorRowIndex &ix = E.index;
+    size_t n = E.rows.size();
+    size_t blocks = (n + BOLT_INDEX_BLOCK - 1) / BOLT_INDEX_BLOCK;
+    ix.rows.assign(blocks, 0);
+    ix.bytes.assign(blocks, 0);
+    for (int k = 0; k < SHADE_COUNT; k++)
+        ix.shades[k].assign(shaded ? blocks : 0, 0);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t b = i / BOLT_INDEX_BLOCK;
+        ix.rows[b]++;
+        ix.bytes[b] += E.rows[i].bytes + 1;
+        for (int k = 0; shaded && k < SHADE_COUNT; k++)
+            ix.shades[k][b] += E.rows[i].shade[k];
+    }
+    ix.shaded = shaded;
+    editorIndexTrees();
+    ix.valid = true;
+}
+
+/**
+ * Stop keeping shade counts, until the overview ruler asks again.
+ */
+static void editorIndexDropShades()
+{
+    editorRowIndex &ix = E.index;
+    ix.shaded = false;
+    for (int k = 0; k < SHADE_COUNT; k++)
+    {
+        ix.shades[k] = std::vector<long long>();
+        ix.shade_trees[k].tree = std::vector<long long>();
+    }
+}
+
+/**
+ * The block holding row 'row', and in 'first' the index of its first
+ * row. For rows.size() it is one past the last block.
+ */
+static size_t editorIndexBlock(int row, int &first)
+{
+    long long rest = row;
+    size_t b = editorFenwickSearch(E.index.rows_tree, rest);
+    first = row - (int)rest;
+    return b;
+}
+
+/**
+ * Add (sign = 1) or remove (sign = -1) 'row' from the totals of block 'b'.
+ */
+static void editorIndexAddTo(size_t b, const ERow &row, int sign)
+{
+    editorRowIndex &ix = E.index;
+    ix.bytes[b] += sign * (row.bytes + 1LL);
+    editorFenwickAdd(ix.bytes_tree, b, sign * (row.bytes + 1LL));
+    for (int k = 0; ix.shaded && k < SHADE_COUNT; k++)
+    {
+        ix.shades[k][b] += sign * row.shade[k];
+        editorFenwickAdd(ix.shade_trees[k], b, sign * row.shade[k]);
+    }
+}
+
+/**
+ * Keep the index in step with a change to the counts of the row at 'at'.
+ */
+static void editorIndexAccount(int at, const ERow &row, int sign)
+{
+    if (!E.index.valid)
+        return;
+    int first;
+    editorIndexAddTo(editorIndexBlock(at, first), row, sign);
+}
+
+/**
+ * Split block 'b', starting at row 'first', into two halves.
+ */
+static void editorIndexSplit(size_t b, int first)
+{
+    editorRowIndex &ix = E.index;
+    long long half = ix.rows[b] / 2;
+    long long bytes = 0;
+    editorShadeCounts shade{};
+    for (int i = first + (int)half; i < first + (int)ix.rows[b]; i++)
+    {
+        bytes += E.rows[i].bytes + 1;
+        for (int k = 0; k < SHADE_COUNT; k++)
+            shade[k] += E.rows[i].shade[k];
+    }
+    ix.rows.insert(ix.rows.begin() + b + 1, ix.rows[b] - half);
+    ix.rows[b] = half;
+    ix.bytes.insert(ix.bytes.begin() + b + 1, bytes);
+    ix.bytes[b] -= bytes;
+    for (int k = 0; ix.shaded && k < SHADE_COUNT; k++)
+    {
+        ix.shades[k].insert(ix.shades[k].begin() + b + 1, shade[k]);
+        ix.shades[k][b] -= shade[k];
+    }
+    editorIndexTrees();
+}
+
+/**
+ * Keep the index in step with the row just inserted at 'at'. Appending
+ * fills the last block and then starts a new one; a block that grows to
+ * twice BOLT_INDEX_BLOCK rows is split.
+ */
+static void editorIndexInsert(int at)
+{
+    editorRowIndex &ix = E.index;
+    if (!ix.valid)
+        return;
+    int first;
+    size_t b = editorIndexBlock(at, first);
+    if (b == ix.rows.size())
+    {
+        if (b == 0 || ix.rows[b - 1] >= BOLT_INDEX_BLOCK)
+        {
+            ix.rows.push_back(0);
+            ix.bytes.push_back(0);
+            editorFenwickPush(ix.rows_tree, 0);
+            editorFenwickPush(ix.bytes_tree, 0);
+            for (int k = 0; ix.shaded && k < SHADE_COUNT; k++)
+            {
+                ix.shades[k].push_back(0);
+                editorFenwickPush(ix.shade_trees[k], 0);
+            }
+        }
+        b = ix.rows.size() - 1;
+        first = at - (int)ix.rows[b];
+    }
+    ix.rows[b]++;
+    editorFenwickAdd(ix.rows_tree, b, 1);
+    editorIndexAddTo(b, E.rows[at], 1);
+    if (ix.rows[b] > 2 * BOLT_INDEX_BLOCK)
+        editorIndexSplit(b, first);
+}
+
+/**
+ * Keep the index in step with the row at 'at' being deleted. A block
+ * left empty is dropped.
+ */
+static void editorIndexDelete(int at)
+{
+    editorRowIndex &ix = E.index;
+    if (!ix.valid)
+        return;
+    int first;
+    size_t b = editorIndexBlock(at, first);
+    editorIndexAddTo(b, E.rows[at], -1);
+    ix.rows[b]--;
+    editorFenwickAdd(ix.rows_tree, b, -1);
+    if (ix.rows[b] > 0)
+        return;
+
+    ix.rows.erase(ix.rows.begin() + b);
+    ix.bytes.erase(ix.bytes.begin() + b);
+    for (int k = 0; ix.shaded && k < SHADE_COUNT; k++)
+        ix.shades[k].erase(ix.shades[k].begin() + b);
+    if (b == ix.rows.size())
+    {
+        // The last node: no other node covers it
+        ix.rows_tree.tree.pop_back();
+        ix.bytes_tree.tree.pop_back();
+        for (int k = 0; ix.shaded && k < SHADE_COUNT; k++)
+            ix.shade_trees[k].tree.pop_back();
+    }
+    else
+    {
+        editorIndexTrees();
+    }
+}
+
+/**
+ * Byte offset of the start of row 'row' (or the file size, for rows.size()).
+ */
+static long long editorRowOffset(int row)
+{
+    if (!E.index.valid)
+        editorIndexBuild(E.show_minimap);
+    int first;
+    size_t b = editorIndexBlock(row, first);
+    if (b == E.index.rows.size())
+        return editorFenwickPrefix(E.index.bytes_tree, b);
+
+    // Count the rows from whichever end of the block is nearer
+    int end = first + (int)E.index.rows[b];
+    long long offset;
+    if (row - first <= end - row)
+    {
+        offset = editorFenwickPrefix(E.index.bytes_tree, b);
+        for (int i = first; i < row; i++)
+            offset += E.rows[i].bytes + 1;
+    }
+    else
+    {
+        offset = editorFenwickPrefix(E.index.bytes_tree, b + 1);
+        for (int i = row; i < end; i++)
+            offset -= E.rows[i].bytes + 1;
+    }
+    return offset;
+}
+
+static long long editorPosToOffset(int row, int col)
+{
+    return editorRowOffset(row) + col;
+}
+
+/**
+ * Find the (row, col) holding byte 'offset'. The newline at the end of
+ * a row maps to the end of that row; offsets past the end of the buffer
+ * map to the end of the last row.
+ */
+static void editorOffsetToPos(long long offset, int &row, int &col)
+{
+    if (!E.index.valid)
+        editorIndexBuild(E.show_minimap);
+    int n = (int)E.rows.size();
+
+    // The block holding it is never empty: an empty one has the same
+    // prefix as the block after it
+    size_t b = editorFenwickSearch(E.index.bytes_tree, offset);
+    if (b >= E.index.rows.size())
+    {
+        row = n > 0 ? n - 1 : 0;
+        col = n > 0 ? E.rows[row].bytes : 0;
+        return;
+    }
+    row = (int)editorFenwickPrefix(E.index.rows_tree, b);
+    while (offset >= E.rows[row].bytes + 1LL)
+        offset -= E.rows[row++].bytes + 1LL;
+    col = (int)std::min(offset, (long long)E.rows[row].bytes);
+}
+
+/**
+ * Total the shade counts of rows [0, row).
+ */
+static void editorShadePrefix(int row, editorShadeCounts &sum)
+{
+    if (!E.index.valid || !E.index.shaded)
+        editorIndexBuild(true);
+    int first;
+    size_t b = editorIndexBlock(row, first);
+    int end = first + (b < E.index.rows.size() ? (int)E.index.rows[b] : 0);
+    if (row - first <= end - row)
+    {
+        for (int k = 0; k < SHADE_COUNT; k++)
+            sum[k] = editorFenwickPrefix(E.index.shade_trees[k], b);
+        for (int i = first; i < row; i++)
+        {
+            for (int k = 0; k < SHADE_COUNT; k++)
+                sum[k] += E.rows[i].shade[k];
+        }
+    }
+    else
+    {
+        for (int k = 0; k < SHADE_COUNT; k++)
+            sum[k] = editorFenwickPrefix(E.index.shade_trees[k], b + 1);
+        for (int i = row; i < end; i++)
+        {
+            for (int k = 0; k < SHADE_COUNT; k++)
+                sum[k] -= E.rows[i].shade[k];
+        }
+    }
+}
+
+/*** anchors ***/
+
+static void editorAnchorApply(editorAnchors &a, int n, int drow, int dcol)
+{
+    if (n < 0)
+        return;
+    editorAnchor &x = a.nodes[n];
+    x.row += drow;
+    x.col += dcol;
+    x.drow += drow;
+    x.dcol += dcol;
+}
+
+static void editorAnchorPush(editorAnchors &a, int n)
+{
+    editorAnchor &x = a.nodes[n];
+    if (x.drow || x.dcol)
+    {
+        editorAnchorApply(a, x.left, x.drow, x.dcol);
+        editorAnchorApply(a, x.right, x.drow, x.dcol);
+        x.drow = x.dcol = 0;
+    }
+}
+
+static void editorAnchorAdopt(editorAnchors &a, int n)
+{
+    a.nodes[n].parent = -1;
+    if (a.nodes[n].left >= 0)
+        a.nodes[a.nodes[n].left].parent = n;
+    if (a.nodes[n].right >= 0)
+        a.nodes[a.nodes[n].right].parent = n;
+}
+
+static bool editorAnchorBefore(const editorAnchor &x, int row, int col)
+{
+    return x.row < row || (x.row == row && x.col < col);
+}
+
+/**
+ * Split the tree at 't' into anchors before (row, col) and the rest.
+ */
+static void editorAnchorSplit(editorAnchors &a, int t, int row, int col, int &l, int &r)
+{
+    if (t < 0)
+    {
+        l = r = -1;
+        return;
+    }
+    editorAnchorPush(a, t);
+    if (editorAnchorBefore(a.nodes[t], row, col))
+    {
+        editorAnchorSplit(a, a.nodes[t].right, row, col, a.nodes[t].right, r);
+        l = t;
+    }
+    else
+    {
+        editorAnchorSplit(a, a.nodes[t].left, row, col, l, a.nodes[t].left);
+        r = t;
+    }
+    editorAnchorAdopt(a, t);
+}
+
+/**
+ * Join two trees where every anchor in 'l' comes before those in 'r'.
+ */
+static int editorAnchorMerge(editorAnchors &a, int l, int r)
+{
+    if (l < 0 || r < 0)
+        return l < 0 ? r : l;
+    if (a.nodes[l].prio > a.nodes[r].prio)
+    {
+        editorAnchorPush(a, l);
+        a.nodes[l].right = editorAnchorMerge(a, a.nodes[l].right, r);
+        editorAnchorAdopt(a, l);
+        return l;
+    }
+    editorAnchorPush(a, r);
+    a.nodes[r].left = editorAnchorMerge(a, l, a.nodes[r].left);
+    editorAnchorAdopt(a, r);
+    return r;
+}
+
+/**
+ * Add an anchor at (row, col) and return its id.
+ */
+static int editorAnchorAdd(editorAnchors &a, int row, int col)
+{
+    unsigned &seed = a.seed;
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+
+    int id;
+    if (!a.free_ids.empty())
+    {
+        id = a.free_ids.back();
+        a.free_ids.pop_back();
+    }
+    else
+    {
+        id = (int)a.nodes.size();
+        a.nodes.emplace_back();
+    }
+    editorAnchor &x = a.nodes[id];
+    x = editorAnchor();
+    x.row = row;
+    x.col = col;
+    x.prio = seed;
+
+    int l, r;
+    editorAnchorSplit(a, a.root, row, col, l, r);
+    a.root = editorAnchorMerge(a, editorAnchorMerge(a, l, id), r);
+    a.count++;
+    return id;
+}
+
+static void editorAnchorPushPath(editorAnchors &a, int n)
+{
+    if (a.nodes[n].parent >= 0)
+        editorAnchorPushPath(a, a.nodes[n].parent);
+    editorAnchorPush(a, n);
+}
+
+/**
+ * Read the current position of anchor 'id', pushing down the deltas on
+ * the path from the root.
+ */
+static void editorAnchorPos(editorAnchors &a, int id, int &row, int &col)
+{
+    editorAnchorPushPath(a, id);
+    row = a.nodes[id].row;
+    col = a.nodes[id].col;
+}
+
+static void editorAnchorRemove(editorAnchors &a, int id)
+{
+    editorAnchorPushPath(a, id);
+
+    editorAnchor &x = a.nodes[id];
+    int child = editorAnchorMerge(a, x.left, x.right);
+    int p = x.parent;
+    if (child >= 0)
+        a.nodes[child].parent = p;
+    if (p < 0)
+        a.root = child;
+    else if (a.nodes[p].left == id)
+        a.nodes[p].left = child;
+    else
+        a.nodes[p].right = child;
+
+    x = editorAnchor();
+    a.free_ids.push_back(id);
+    a.count--;
+}
+
+/**
+ * Move every anchor in [(r0, c0), (r1, c1)) by (drow, dcol). The caller
+ * makes sure the moved anchors still sort between their neighbours.
+ */
+static void editorAnchorShift(editorAnchors &a, int r0, int c0, int r1, int c1, int drow, int dcol)
+{
+    if (a.root < 0)
+        return;
+    int l, mid, r;
+    editorAnchorSplit(a, a.root, r0, c0, l, mid);
+    editorAnchorSplit(a, mid, r1, c1, mid, r);
+    editorAnchorApply(a, mid, drow, dcol);
+    a.root = editorAnchorMerge(a, editorAnchorMerge(a, l, mid), r);
+}
+
+static void editorAnchorClampTree(editorAnchors &a, int n, int lo, int hi)
+{
+    if (n < 0)
+        return;
+    editorAnchorPush(a, n);
+    editorAnchor &x = a.nodes[n];
+    x.col = std::min(std::max(x.col, lo), hi);
+    editorAnchorClampTree(a, x.left, lo, hi);
+    editorAnchorClampTree(a, x.right, lo, hi);
+}
+
+/**
+ * Clamp the columns of the anchors on 'row' in [c0, c1) to [lo, hi].
+ * This takes time in the number of anchors affected, and keeps their
+ * order, so the caller must keep 'lo' and 'hi' inside the gap they
+ * leave on the row.
+ */
+static void editorAnchorClamp(editorAnchors &a, int row, int c0, int c1, int lo, int hi)
+{
+    if (a.root < 0)
+        return;
+    int l, mid, r;
+    editorAnchorSplit(a, a.root, row, c0, l, mid);
+    editorAnchorSplit(a, mid, row, c1, mid, r);
+    editorAnchorClampTree(a, mid, lo, hi);
+    a.root = editorAnchorMerge(a, editorAnchorMerge(a, l, mid), r);
+}
+
+/**
+ * The first anchor at or after (row, col), or -1.
+ */
+static int editorAnchorLowerBound(editorAnchors &a, int row, int col)
+{
+    int found = -1;
+    for (int n = a.root; n >= 0;)
+    {
+        editorAnchorPush(a, n);
+        if (editorAnchorBefore(a.nodes[n], row, col))
+        {
+            n = a.nodes[n].right;
+        }
+        else
+        {
+            found = n;
+            n = a.nodes[n].left;
+        }
+    }
+    return found;
+}
+
+/**
+ * The last anchor before (row, col), or -1.
+ */
+static int editorAnchorLastBefore(editorAnchors &a, int row, int col)
+{
+    int found = -1;
+    for (int n = a.root; n >= 0;)
+    {
+        editorAnchorPush(a, n);
+        if (editorAnchorBefore(a.nodes[n], row, col))
+        {
+            found = n;
+            n = a.nodes[n].right;
+        }
+        else
+        {
+            n = a.nodes[n].left;
+        }
+    }
+    return found;
+}
+
+/**
+ * Whether any anchor lies on rows [first, last).
+ */
+static bool editorAnchorInRows(editorAnchors &a, int first, int last)
+{
+    int n = editorAnchorLowerBound(a, first, INT_MIN);
+    return n >= 0 && a.nodes[n].row < last;
+}
+
+/**
+ * Append the ids of the anchors under 'n' on rows [first, last) to 'out',
+ * in order. Only the subtrees that reach into the rows are visited.
+ */
+static void editorAnchorRows(editorAnchors &a, int n, int first, int last, std::vector<int> &out)
+{
+    if (n < 0)
+        return;
+    editorAnchorPush(a, n);
+    int row = a.nodes[n].row;
+    if (row >= first)
+        editorAnchorRows(a, a.nodes[n].left, first, last, out);
+    if (row >= first && row < last)
+        out.push_back(n);
+    if (row < last)
+        editorAnchorRows(a, a.nodes[n].right, first, last, out);
+}
+
+/*
+ * The edits below keep the active buffer's anchors in step with its text.
+ */
+
+static void editorAnchorsShift(int r0, int c0, int r1, int c1, int drow, int dcol)
+{
+    editorAnchorShift(E.bookmarks, r0, c0, r1, c1, drow, dcol);
+    editorAnchorShift(E.marks, r0, c0, r1, c1, drow, dcol);
+    editorAnchorShift(E.diagnostics, r0, c0, r1, c1, drow, dcol);
+}
+
+static void editorAnchorsClamp(int row, int c0, int c1, int lo, int hi)
+{
+    editorAnchorClamp(E.bookmarks, row, c0, c1, lo, hi);
+    editorAnchorClamp(E.marks, row, c0, c1, lo, hi);
+    editorAnchorClamp(E.diagnostics, row, c0, c1, lo, hi);
+}
+
+/**
+ * 'n' characters were erased from 'row' at 'col': anchors inside them
+ * move to 'col', and anchors after them move back.
+ */
+static void editorAnchorsErase(int row, int col, int n)
+{
+    editorAnchorsClamp(row, col, col + n, col, col);
+    editorAnchorsShift(row, col + n, row + 1, INT_MIN, 0, -n);
+}
+
+/**
+ * Row 'at' was deleted: its anchors move to the start of the row that
+ * takes its place, and those below move up.
+ */
+static void editorAnchorsDeleteRow(int at)
+{
+    editorAnchorsClamp(at, INT_MIN, INT_MAX, 0, 0);
+    editorAnchorsShift(at + 1, INT_MIN, INT_MAX, 0, -1, 0);
+}
+
+/**
+ * Add (sign = 1) or remove (sign = -1) a row's counts from the buffer
+ * totals, and from the offset and shade indexes if the row sits at index
+ * 'at' of E.rows (pass -1 otherwise). Uses the counts cached at the last render,
+ * so removal still works after 'chars' has been edited.
+ */
+static void editorAccountRow(const ERow &row, int at, int sign)
+{
+    E.stats.bytes += sign * row.bytes;
+    E.stats.words += sign * row.words;
+    E.stats.chars += sign * row.glyphs;
+    if (at >= 0)
+    {
+        editorIndexAccount(at, row, sign);
+    }
+
+    int width = row.width;
+    if (sign > 0)
+    {
+        E.stats.widths[width]++;
+    }
+    else
+    {
+        auto it = E.stats.widths.find(width);
+        if (it != E.stats.widths.end() && --it->second == 0)
+            E.stats.widths.erase(it);
+    }
+}
+
+/**
+ * Re-render a row of E.rows after its 'chars' changed.
+ */
+static void editorUpdateRow(ERow &row)
+{
+    int at = (int)(&row - E.rows.data());
+    editorAccountRow(row, at, -1);
+    editorRenderRow(row);
+    row.shade[SHADE_MODIFIED] = 1;
+    editorAccountRow(row, at, 1);
+    editorCacheCharge(at);
+    row.referenced = true;
+}
+
+/**
+ * Ask for transparent huge pages over the whole huge pages within
+ * ['p', 'p' + 'len') (set huge-pages on). Pages already touched are
+ * left to khugepaged, so this pays off on an array that was just grown
+ * and is still filling up.
+ */
+static void editorAdviseHuge(const void *p, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+    uintptr_t start = ((uintptr_t)p + BOLT_HUGE_PAGE - 1) & ~(uintptr_t)(BOLT_HUGE_PAGE - 1);
+    uintptr_t end = ((uintptr_t)p + len) & ~(uintptr_t)(BOLT_HUGE_PAGE - 1);
+    if (end > start)
+        madvise((void *)start, end - start, MADV_HUGEPAGE);
+#else
+    (void)p;
+    (void)len;
+#endif
+}
+
+/**
+ * Insert a new row into E.rows at index 'at'. Rows read from a file pass
+ * modified = false, so the overview ruler doesn't mark them as changed.
+ */
+static void editorInsertRow(int at, const std::string &s, bool modified = true)
+{
+    if (at < 0 || at > (int)E.rows.size())
+        return;
+
+    // Rows the loader appends are already counted in the file lines that
+    // anchors past them refer to
+    if (modified || at < (int)E.rows.size())
+        editorAnchorsShift(at, INT_MIN, INT_MAX, 0, 1, 0);
+
+    ERow newRow;
+    newRow.chars = s;
+    // Rows read from a file once the cache is full would only be evicted
+    if (!modified && E.cache_budget > 0 && editorCacheTotal() >= E.cache_budget)
+        editorRenderRowEvicted(newRow);
+    else
+        editorRenderRow(newRow);
+    newRow.shade[SHADE_MODIFIED] = modified;
+    editorAccountRow(newRow, -1, 1);
+
+    if (at < (int)E.rows.size())
+    {
+        E.undo.clear();
+        E.match_rows.clear();
+        E.match_query.clear();
+        editorCacheShift(at, 1);
+    }
+    size_t capacity = E.rows.capacity();
+    E.rows.insert(E.rows.begin() + at, std::move(newRow));
+    if (E.huge_pages && E.rows.capacity() != capacity)
+        editorAdviseHuge(E.rows.data(), E.rows.capacity() * sizeof(ERow));
+    editorIndexInsert(at);
+    editorCacheCharge(at);
+    E.dirty = true;
+}
+
+/**
+ * Delete row at index 'at'.
+ */
+static void editorDelRow(int at)
+{
+    if (at < 0 || at >= (int)E.rows.size())
+        return;
+    editorAccountRow(E.rows[at], -1, -1);
+    E.cache.bytes -= E.rows[at].cached;
+    editorCacheShift(at, -1);
+    editorIndexDelete(at);
+    editorAnchorsDeleteRow(at);
+    E.rows.erase(E.rows.begin() + at);
+    E.undo.clear();
+    E.match_rows.clear();
+    E.match_query.clear();
+    E.dirty = true;
+}
+
+/**
+ * Insert a single character 'c' into row 'row' at position 'at'.
+ */
+static void editorRowInsertChar(ERow &row, int at, char c)
+{
+    if (at < 0 || at > (int)row.chars.size())
+    {
+        at = (int)row.chars.size();
+    }
+    row.chars.insert(row.chars.begin() + at, c);
+    int y = (int)(&row - E.rows.data());
+    editorAnchorsShift(y, at + 1, y + 1, INT_MIN, 0, 1);
+    editorUpdateRow(row);
+    E.undo.clear();
+    E.dirty = true;
+}
+
+/**
+ * Append a string 's' to row 'row'.
+ */
+static void editorRowAppendString(ERow &row, const std::string &s)
+{
+    row.chars += s;
+    editorUpdateRow(row);
+    E.undo.clear();
+    E.dirty = true;
+}
+
+/**
+ * Delete the character at position 'at' in row 'row'.
+ */
+static void editorRowDelChar(ERow &row, int at)
+{
+    if (at < 0 || at >= (int)row.chars.size())
+        return;
+    row.chars.erase(row.chars.begin() + at);
+    editorAnchorsErase((int)(&row - E.rows.data()), at, 1);
+    editorUpdateRow(row);
+    E.undo.clear();
+    E.dirty = true;
+}
+
+/*** editor operations ***/
+
+/**
+ * Insert a character at the current cursor position. If the cursor
+ * is beyond the last row, create a new row first.
+ */
+static void editorInsertChar(char c)
+{
+    editorEnsureRows((size_t)E.cy + 1);
+    if (E.cy == (int)E.rows.size())
+    {
+        // We are on a 'virtual' row past the end, so create a new empty row
+        editorInsertRow((int)E.rows.size(), "");
+    }
+    editorRowInsertChar(E.rows[E.cy], E.cx, c);
+    E.cx++;
+}
+
+/**
+ * One level of indentation in the style 'row' already uses: a tab,
+ * unless the row is indented with spaces.
+ */
+static std::string editorIndentUnit(const ERow &row)
+{
+    if (row.indent_len > 0 && row.chars[0] == ' ')
+        return std::string(BOLT_INDENT_SPACES, ' ');
+    return "\t";
+}
+
+/**
+ * True if the last non-blank character before 'cx' is a '{' that the
+ * highlighter considers code (not inside a string or comment).
+ */
+static bool editorOpensBlock(const ERow &row, int cx)
+{
+    int i = cx - 1;
+    while (i >= 0 && (row.chars[i] == ' ' || row.chars[i] == '\t'))
+        i--;
+    if (i < 0 || row.chars[i] != '{')
+        return false;
+    int hl = row.hl[editorRowCxToRx(row, i)];
+    return hl != HL_STRING && hl != HL_COMMENT;
+}
+
+/**
+ * Insert a newline at the current cursor. If E.cx == 0,
+ * just insert a blank row above the current row; otherwise,
+ * split the current line at E.cx. The new line copies the
+ * current line's indentation, one level deeper after a '{'.
+ * Splitting between '{' and '}' puts the '}' on its own line.
+ */
+static void editorInsertNewline()
+{
+    if (E.cx == 0)
+    {
+        // Insert an empty row before this one
+        editorInsertRow(E.cy, "");
+        E.cy++;
+        return;
+    }
+
+    ERow &row = editorRowCached(E.cy);
+    std::string indent = row.chars.substr(0, std::min(row.indent_len, E.cx));
+    std::string inner = indent;
+    if (editorOpensBlock(row, E.cx))
+        inner += editorIndentUnit(row);
+
+    // The substring from E.cx onward, without its leading blanks
+    size_t rest = row.chars.find_first_not_of(" \t", E.cx);
+    std::string splitText = rest == std::string::npos ? "" : row.chars.substr(rest);
+    int skipped = rest == std::string::npos ? (int)row.chars.size() : (int)rest;
+    // Trim the current row
+    row.chars.erase(E.cx);
+    editorUpdateRow(row);
+    E.undo.clear();
+
+    int split_row = E.cy + 1;
+    int split_col = (int)inner.size();
+    if (inner.size() > indent.size() && !splitText.empty() && splitText[0] == '}')
+    {
+        editorInsertRow(E.cy + 1, indent + splitText);
+        splitText.clear();
+        split_row++;
+        split_col = (int)indent.size();
+    }
+    // Insert the new row below
+    editorInsertRow(E.cy + 1, inner + splitText);
+
+    // Anchors after the cursor follow the text onto its new row
+    editorAnchorsClamp(E.cy, E.cx, skipped, skipped, skipped);
+    editorAnchorsShift(E.cy, E.cx, E.cy + 1, INT_MIN, split_row - E.cy, split_col - skipped);
+    E.cy++;
+    E.cx = (int)inner.size();
+}
+
+/**
+ * Typing '}' as the first thing on an indented line drops one
+ * indentation level before inserting it.
+ */
+static void editorOutdentForClose()
+{
+    if (E.cy >= (int)E.rows.size())
+        return;
+    ERow &row = E.rows[E.cy];
+    if (E.cx == 0 || E.cx != row.indent_len)
+        return;
+
+    int remove = 1;
+    if (row.chars[E.cx - 1] == ' ')
+    {
+        remove = 0;
+        while (remove < BOLT_INDENT_SPACES && remove < E.cx && row.chars[E.cx - 1 - remove] == ' ')
+            remove++;
+    }
+    row.chars.erase(E.cx - remove, remove);
+    editorAnchorsErase(E.cy, E.cx - remove, remove);
+    editorUpdateRow(row);
+    E.undo.clear();
+    E.cx -= remove;
+    E.dirty = true;
+}
+
+/**
+ * Delete the character behind the cursor. If we're at the start
+ * of a line, then we merge with the previous line.
+ */
+static void editorDelChar()
+{
+    if (E.cy == (int)E.rows.size())
+        return;
+    if (E.cx == 0 && E.cy == 0)
+        return;
+
+    ERow &row = E.rows[E.cy];
+    if (E.cx > 0)
+    {
+        editorRowDelChar(row, E.cx - 1);
+        E.cx--;
+    }
+    else
+    {
+        // Merge current row into previous row
+        E.cx = (int)E.rows[E.cy - 1].chars.size();
+        editorAnchorsShift(E.cy, INT_MIN, E.cy + 1, INT_MIN, -1, E.cx);
+        editorRowAppendString(E.rows[E.cy - 1], row.chars);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+
+/*** row workers ***/
+
+/*
+ * Large batches of rows are re-rendered on a pool of worker threads
+ * shared by all editors, started the first time one is needed and kept
+ * for the life of the process. The thread with the batch works on it
+ * too, so it completes even while the workers are busy with another
+ * editor's.
+ */
+struct editorRowBatch
+{
+    BoltEditorState *state; // Whose rows; the workers bind it while they render
+    int last;
+    std::atomic<int> next;  // First row not yet taken
+    int users = 0;          // Workers rendering a part of it, under the pool lock
+};
+
+struct editorWorkers
+{
+    std::mutex lock;
+    std::condition_variable wake;     // A batch was queued
+    std::condition_variable finished; // A worker left a batch
+    std::deque<editorRowBatch *> batches;
+};
+
+static editorWorkers *workers; // Never freed: the threads wait on it until exit
+
+/**
+ * Take the next chunk of 'b' and render it. Returns false once there is
+ * nothing left to take.
+ */
+static bool editorRenderChunk(editorRowBatch &b)
+{
+    int start = b.next.fetch_add(BOLT_PARALLEL_CHUNK);
+    if (start >= b.last)
+        return false;
+    int end = std::min(start + BOLT_PARALLEL_CHUNK, b.last);
+    for (int i = start; i < end; i++)
+        editorRenderRow(E.rows[i]);
+    return true;
+}
+
+static void editorWorkerMain()
+{
+    std::unique_lock<std::mutex> hold(workers->lock);
+    while (true)
+    {
+        workers->wake.wait(hold, [] { return !workers->batches.empty(); });
+        editorRowBatch *b = workers->batches.front();
+        if (b->next >= b->last)
+        {
+            workers->batches.pop_front(); // All taken; the rest finish it
+            continue;
+        }
+        b->users++;
+        hold.unlock();
+        editorBind(b->state);
+        while (editorRenderChunk(*b))
+            ;
+        editorBind(nullptr);
+        hold.lock();
+        b->users--;
+        workers->finished.notify_all();
+    }
+}
+
+/**
+ * Start the pool: one worker per core besides the caller's. Returns
+ * false on a single core, where batches are rendered in place.
+ */
+static bool editorStartWorkers()
+{
+    static std::once_flag started;
+    std::call_once(started, [] {
+        unsigned count = std::thread::hardware_concurrency();
+        if (count < 2)
+            return;
+        workers = new editorWorkers;
+        for (unsigned i = 1; i < count; i++)
+            std::thread(editorWorkerMain).detach();
+    });
+    return workers != nullptr;
+}
+
+/**
+ * Render rows [first, last) of E.rows on the pool and this thread.
+ */
+static void editorRenderBatch(int first, int last)
+{
+    editorRowBatch b;
+    b.state = bound_state;
+    b.last = last;
+    b.next = first;
+    {
+        std::lock_guard<std::mutex> hold(workers->lock);
+        workers->batches.push_back(&b);
+    }
+    workers->wake.notify_all();
+
+    while (editorRenderChunk(b))
+        ;
+
+    std::unique_lock<std::mutex> hold(workers->lock);
+    auto queued = std::find(workers->batches.begin(), workers->batches.end(), &b);
+    if (queued != workers->batches.end())
+        workers->batches.erase(queued);
+    workers->finished.wait(hold, [&b] { return b.users == 0; });
+}
+
+/*** region operations ***/
+
+/**
+ * Re-render rows [first, last). Large batches are split across the
+ * worker threads running editorRenderRow; the shared bookkeeping around
+ * it stays on this thread.
+ */
+static void editorUpdateRows(int first, int last)
+{
+    for (int i = first; i < last; i++)
+        editorAnchorsClamp(i, INT_MIN, INT_MAX, 0, (int)E.rows[i].chars.size());
+
+    if (last - first < BOLT_PARALLEL_ROWS || !editorStartWorkers())
+    {
+        for (int i = first; i < last; i++)
+            editorUpdateRow(E.rows[i]);
+        return;
+    }
+
+    for (int i = first; i < last; i++)
+        editorAccountRow(E.rows[i], i, -1);
+
+    editorRenderBatch(first, last);
+
+    for (int i = first; i < last; i++)
+    {
+        E.rows[i].shade[SHADE_MODIFIED] = 1;
+        editorAccountRow(E.rows[i], i, 1);
+        editorCacheCharge(i);
+    }
+}
+
+/**
+ * The rows a region operation applies to: every row touched by the
+ * selection (not counting a final row selected only up to column 0),
+ * or just the cursor row. Returns false if there are none.
+ */
+static bool editorRegionRows(int &first, int &last)
+{
+    first = last = E.cy;
+    if (E.sel_active)
+    {
+        int end_cx = E.cy >= E.sel_cy ? E.cx : E.sel_cx;
+        first = std::min(E.cy, E.sel_cy);
+        last = std::max(E.cy, E.sel_cy);
+        if (last > first && end_cx == 0)
+            last--;
+    }
+    last = std::min(last, (int)E.rows.size() - 1);
+    return first <= last;
+}
+
+/**
+ * Install 'chars' as the new text of rows [first, first + chars.size()),
+ * keeping the old text as one undo group, then re-render them in a batch.
+ */
+static void editorRegionReplace(int first, std::vector<std::string> &chars)
+{
+    editorUndoGroup group = {first, std::vector<std::string>(), E.cx, E.cy};
+    group.before.reserve(chars.size());
+    for (size_t i = 0; i < chars.size(); i++)
+    {
+        group.before.push_back(std::move(E.rows[first + i].chars));
+        E.rows[first + i].chars = std::move(chars[i]);
+    }
+    editorUpdateRows(first, first + (int)chars.size());
+
+    if (E.undo.size() == BOLT_UNDO_GROUPS)
+        E.undo.erase(E.undo.begin());
+    E.undo.push_back(std::move(group));
+    E.dirty = true;
+}
+
+/**
+ * Clamp the cursor and the selection anchor to their rows after a region
+ * operation shortened them. Either may be on the virtual row past the
+ * end, which is empty.
+ */
+static void editorClampRegionEnds()
+{
+    int rowlen = E.cy < (int)E.rows.size() ? (int)E.rows[E.cy].chars.size() : 0;
+    if (E.cx > rowlen)
+        E.cx = rowlen;
+    if (E.sel_active)
+    {
+        int sel_len = E.sel_cy < (int)E.rows.size() ? (int)E.rows[E.sel_cy].chars.size() : 0;
+        if (E.sel_cx > sel_len)
+            E.sel_cx = sel_len;
+    }
+}
+
+static bool editorRowIsBlank(const ERow &row)
+{
+    return row.indent_len == (int)row.chars.size();
+}
+
+/**
+ * Indent (direction > 0) or outdent (direction < 0) every non-blank
+ * row in the region by one level.
+ */
+static void editorIndentRegion(int direction)
+{
+    int first, last;
+    if (!editorRegionRows(first, last))
+        return;
+
+    std::string unit = editorIndentUnit(E.rows[first]);
+    std::vector<std::string> chars;
+    chars.reserve(last - first + 1);
+    for (int i = first; i <= last; i++)
+    {
+        const ERow &row = E.rows[i];
+        if (editorRowIsBlank(row))
+        {
+            chars.push_back(row.chars);
+        }
+        else if (direction > 0)
+        {
+            chars.push_back(unit + row.chars);
+        }
+        else
+        {
+            int remove = 0;
+            if (row.indent_len > 0 && row.chars[0] == '\t')
+                remove = 1;
+            while (remove < BOLT_INDENT_SPACES && remove < row.indent_len && row.chars[remove] == ' ')
+                remove++;
+            chars.push_back(row.chars.substr(remove));
+        }
+    }
+    editorRegionReplace(first, chars);
+    editorClampRegionEnds();
+}
+
+/**
+ * Comment out the region with the filetype's single-line comment marker,
+ * or, if every non-blank row already starts with it, uncomment it.
+ */
+static void editorToggleCommentRegion()
+{
+    if (!E.syntax || E.syntax->singleline_comment_start.empty())
+    {
+        editorSetStatusMessage("No line comment for this filetype");
+        return;
+    }
+    int first, last;
+    if (!editorRegionRows(first, last))
+        return;
+
+    const std::string &marker = E.syntax->singleline_comment_start;
+    bool all_commented = true;
+    int min_indent = -1;
+    for (int i = first; i <= last; i++)
+    {
+        const ERow &row = E.rows[i];
+        if (editorRowIsBlank(row))
+            continue;
+        if (row.chars.compare(row.indent_len, marker.size(), marker) != 0)
+            all_commented = false;
+        if (min_indent < 0 || row.indent_len < min_indent)
+            min_indent = row.indent_len;
+    }
+    if (min_indent < 0)
+        return; // Only blank rows
+
+    std::vector<std::string> chars;
+    chars.reserve(last - first + 1);
+    for (int i = first; i <= last; i++)
+    {
+        const ERow &row = E.rows[i];
+        if (editorRowIsBlank(row))
+        {
+            chars.push_back(row.chars);
+        }
+        else if (all_commented)
+        {
+            size_t end = row.indent_len + marker.size();
+            if (end < row.chars.size() && row.chars[end] == ' ')
+                end++;
+            chars.push_back(row.chars.substr(0, row.indent_len) + row.chars.substr(end));
+        }
+        else
+        {
+            chars.push_back(row.chars.substr(0, min_indent) + marker + " " + row.chars.substr(min_indent));
+        }
+    }
+    editorRegionReplace(first, chars);
+    editorClampRegionEnds();
+}
+
+/**
+ * Revert the most recent region operation.
+ */
+static void editorUndo()
+{
+    if (E.undo.empty())
+    {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    editorUndoGroup group = std::move(E.undo.back());
+    E.undo.pop_back();
+    for (size_t i = 0; i < group.before.size(); i++)
+        E.rows[group.first + i].chars = std::move(group.before[i]);
+    editorUpdateRows(group.first, group.first + (int)group.before.size());
+    E.cx = group.cx;
+    E.cy = group.cy;
+    E.dirty = true;
+}
+
+/*** encoding ***/
+
+static const char *editorEncodingName(int encoding)
+{
+    switch (encoding)
+    {
+    case ENC_UTF16LE:
+        return "utf-16le";
+    case ENC_UTF16BE:
+        return "utf-16be";
+    case ENC_LATIN1:
+        return "latin-1";
+    default:
+        return "utf-8";
+    }
+}
+
+static void editorAppendUtf8(std::string &out, unsigned cp)
+{
+    if (cp < 0x80)
+    {
+        out += (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+/**
+ * Decode one UTF-8 sequence at p[*i], advancing *i. Bytes that don't
+ * form a valid sequence decode as themselves (i.e. as Latin-1), so
+ * nothing is lost on a round trip. Returns -1 if the sequence is cut
+ * off by the end of the input.
+ */
+static int editorNextUtf8(const unsigned char *p, size_t n, size_t *i)
+{
+    unsigned c = p[*i];
+    int extra = c >= 0xF0 && c < 0xF5 ? 3 : c >= 0xE0 && c < 0xF0 ? 2 : c >= 0xC2 && c < 0xE0 ? 1 : 0;
+    if (extra == 0)
+    {
+        (*i)++;
+        return (int)c;
+    }
+    if (*i + extra >= n)
+        return -1;
+    unsigned cp = c & (0x3F >> extra);
+    for (int k = 1; k <= extra; k++)
+    {
+        unsigned cc = p[*i + k];
+        if ((cc & 0xC0) != 0x80)
+        {
+            (*i)++;
+            return (int)c;
+        }
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    *i += extra + 1;
+    return (int)cp;
+}
+
+/**
+ * Length of the run of ASCII bytes at the start of p[0..n).
+ */
+#ifdef BOLT_MULTIVERSION
+__attribute__((target("default"), unused)) // Unused if -march already has AVX2
+#endif
+static size_t editorAsciiRun(const unsigned char *p, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        int mask = _mm_movemask_epi8(v);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i + 8 <= n; i += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        if (v & 0x8080808080808080ULL)
+            break;
+    }
+    while (i < n && p[i] < 0x80)
+        i++;
+    return i;
+}
+
+#ifdef BOLT_MULTIVERSION
+__attribute__((target("avx2"))) static size_t editorAsciiRun(const unsigned char *p, size_t n)
+{
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        int mask = _mm256_movemask_epi8(v);
+        if (mask)
+            return i + __builtin_ctz((unsigned)mask);
+    }
+    while (i < n && p[i] < 0x80)
+        i++;
+    return i;
+}
+#endif
+
+/**
+ * True if the first 'n' bytes look like valid UTF-8. A sequence cut off
+ * at the end of the sample is given the benefit of the doubt.
+ */
+static bool editorLooksUtf8(const unsigned char *p, size_t n)
+{
+    size_t i = 0;
+    while (i < n)
+    {
+        i += editorAsciiRun(p + i, n - i);
+        if (i >= n)
+            break;
+        size_t start = i;
+        int cp = editorNextUtf8(p, n, &i);
+        if (cp == -1)
+            return true;
+        if (i == start + 1)
+            return false; // A lone high byte: not UTF-8
+    }
+    return true;
+}
+
+/**
+ * Choose an encoding from the first block of a file: a byte order mark
+ * if there is one, otherwise the pattern of NUL bytes (UTF-16) or
+ * whether the bytes are valid UTF-8. Returns the length of the BOM.
+ */
+static size_t editorDetectEncoding(const unsigned char *p, size_t n, int &encoding, bool &bom)
+{
+    bom = true;
+    if (n >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF)
+    {
+        encoding = ENC_UTF8;
+        return 3;
+    }
+    if (n >= 2 && p[0] == 0xFF && p[1] == 0xFE)
+    {
+        encoding = ENC_UTF16LE;
+        return 2;
+    }
+    if (n >= 2 && p[0] == 0xFE && p[1] == 0xFF)
+    {
+        encoding = ENC_UTF16BE;
+        return 2;
+    }
+    bom = false;
+
+    // Mostly-ASCII UTF-16 has a NUL in every other byte
+    size_t even_nuls = 0, odd_nuls = 0;
+    for (size_t i = 0; i + 1 < n; i += 2)
+    {
+        even_nuls += p[i] == 0;
+        odd_nuls += p[i + 1] == 0;
+    }
+    size_t units = n / 2;
+    if (units >= 2 && odd_nuls * 10 >= units * 3 && even_nuls * 10 < units)
+        encoding = ENC_UTF16LE;
+    else if (units >= 2 && even_nuls * 10 >= units * 3 && odd_nuls * 10 < units)
+        encoding = ENC_UTF16BE;
+    else if (editorLooksUtf8(p, n))
+        encoding = ENC_UTF8;
+    else
+        encoding = ENC_LATIN1;
+    return 0;
+}
+
+/**
+ * Decode the run of ASCII UTF-16 code units at the start of p[0..n),
+ * appending it to 'out'. Returns the number of bytes consumed.
+ */
+#ifdef BOLT_MULTIVERSION
+__attribute__((target("default"), unused))
+#endif
+static size_t editorUtf16AsciiRun(const unsigned char *p, size_t n, bool big_endian, std::string &out)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i high = _mm_set1_epi16((short)0xFF80);
+    char narrow[16];
+    for (; i + 16 <= n; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        if (big_endian)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        __m128i nonascii = _mm_cmpeq_epi16(_mm_and_si128(v, high), _mm_setzero_si128());
+        if (_mm_movemask_epi8(nonascii) != 0xFFFF)
+            break;
+        _mm_storeu_si128((__m128i *)narrow, _mm_packus_epi16(v, v));
+        out.append(narrow, 8);
+    }
+#endif
+    for (; i + 1 < n; i += 2)
+    {
+        unsigned u = big_endian ? (p[i] << 8 | p[i + 1]) : (p[i] | p[i + 1] << 8);
+        if (u >= 0x80)
+            break;
+        out += (char)u;
+    }
+    return i;
+}
+
+#ifdef BOLT_MULTIVERSION
+__attribute__((target("avx2"))) static size_t editorUtf16AsciiRun(const unsigned char *p, size_t n,
+                                                                 bool big_endian, std::string &out)
+{
+    size_t i = 0;
+    const __m256i high = _mm256_set1_epi16((short)0xFF80);
+    char narrow[32];
+    for (; i + 32 <= n; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        if (big_endian)
+            v = _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+        __m256i nonascii = _mm256_cmpeq_epi16(_mm256_and_si256(v, high), _mm256_setzero_si256());
+        if ((unsigned)_mm256_movemask_epi8(nonascii) != 0xFFFFFFFFu)
+            break;
+        // The pack works per 128-bit lane; put the two halves together
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xD8);
+        _mm256_storeu_si256((__m256i *)narrow, packed);
+        out.append(narrow, 16);
+    }
+    if (i + 16 <= n) // Runs between non-ASCII characters are often short
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        if (big_endian)
+            v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        __m128i nonascii = _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16((short)0xFF80)), _mm_setzero_si128());
+        if (_mm_movemask_epi8(nonascii) == 0xFFFF)
+        {
+            _mm_storeu_si128((__m128i *)narrow, _mm_packus_epi16(v, v));
+            out.append(narrow, 8);
+            i += 16;
+        }
+    }
+    for (; i + 1 < n; i += 2)
+    {
+        unsigned u = big_endian ? (p[i] << 8 | p[i + 1]) : (p[i] | p[i + 1] << 8);
+        if (u >= 0x80)
+            break;
+        out += (char)u;
+    }
+    return i;
+}
+#endif
+
+/**
+ * editorUtf16Widen a byte at a time, for what is left after the vectors.
+ */
+static void editorUtf16WidenTail(const unsigned char *p, size_t n, bool big_endian, std::string &out)
+{
+    size_t at = out.size();
+    out.resize(at + 2 * n);
+    char *unit = &out[at];
+    for (size_t k = 0; k < n; k++, unit += 2)
+    {
+        unit[big_endian] = (char)p[k];
+        unit[!big_endian] = 0;
+    }
+}
+
+/**
+ * Encode the ASCII bytes p[0..n) as UTF-16, appending them to 'out'.
+ */
+#ifdef BOLT_MULTIVERSION
+__attribute__((target("default"), unused))
+#endif
+static void editorUtf16Widen(const unsigned char *p, size_t n, bool big_endian, std::string &out)
+{
+    size_t k = 0;
+#ifdef __SSE2__
+    char wide[32];
+    for (; k + 16 <= n; k += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + k));
+        __m128i zero = _mm_setzero_si128();
+        _mm_storeu_si128((__m128i *)wide, big_endian ? _mm_unpacklo_epi8(zero, v) : _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i *)(wide + 16), big_endian ? _mm_unpackhi_epi8(zero, v) : _mm_unpackhi_epi8(v, zero));
+        out.append(wide, 32);
+    }
+#endif
+    editorUtf16WidenTail(p + k, n - k, big_endian, out);
+}
+
+#ifdef BOLT_MULTIVERSION
+__attribute__((target("avx2"))) static void editorUtf16Widen(const unsigned char *p, size_t n, bool big_endian,
+                                                            std::string &out)
+{
+    size_t k = 0;
+    char wide[64];
+    for (; k + 32 <= n; k += 32)
+    {
+        // The unpacks work per 128-bit lane, so first move bytes 8-15
+        // into the low lane's upper half and 16-23 into the high lane's
+        __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i *)(p + k)), 0xD8);
+        __m256i zero = _mm256_setzero_si256();
+        _mm256_storeu_si256((__m256i *)wide, big_endian ? _mm256_unpacklo_epi8(zero, v) : _mm256_unpacklo_epi8(v, zero));
+        _mm256_storeu_si256((__m256i *)(wide + 32),
+                            big_endian ? _mm256_unpackhi_epi8(zero, v) : _mm256_unpackhi_epi8(v, zero));
+        out.append(wide, 64);
+    }
+    if (k + 16 <= n) // Runs between non-ASCII characters are often short
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + k));
+        __m128i zero = _mm_setzero_si128();
+        _mm_storeu_si128((__m128i *)wide, big_endian ? _mm_unpacklo_epi8(zero, v) : _mm_unpacklo_epi8(v, zero));
+        _mm_storeu_si128((__m128i *)(wide + 16), big_endian ? _mm_unpackhi_epi8(zero, v) : _mm_unpackhi_epi8(v, zero));
+        out.append(wide, 32);
+        k += 16;
+    }
+    editorUtf16WidenTail(p + k, n - k, big_endian, out);
+}
+#endif
+
+/**
+ * Decode UTF-16 into UTF-8. Returns the number of bytes consumed, which
+ * is short of 'n' if the input ends inside a code unit or surrogate pair.
+ */
+static size_t editorDecodeUtf16(const unsigned char *p, size_t n, bool big_endian, std::string &out)
+{
+    size_t i = 0;
+    while (i + 1 < n)
+    {
+        i += editorUtf16AsciiRun(p + i, n - i, big_endian, out);
+        if (i + 1 >= n)
+            break;
+
+        unsigned u = big_endian ? (p[i] << 8 | p[i + 1]) : (p[i] | p[i + 1] << 8);
+        unsigned cp = u;
+        if (u >= 0xD800 && u < 0xDC00)
+        {
+            if (i + 3 >= n)
+                break; // Wait for the low surrogate
+            unsigned lo = big_endian ? (p[i + 2] << 8 | p[i + 3]) : (p[i + 2] | p[i + 3] << 8);
+            if (lo >= 0xDC00 && lo < 0xE000)
+            {
+                cp = 0x10000 + ((u - 0xD800) << 10) + (lo - 0xDC00);
+                i += 2;
+            }
+            else
+            {
+                cp = 0xFFFD;
+            }
+        }
+        else if (u >= 0xDC00 && u < 0xE000)
+        {
+            cp = 0xFFFD;
+        }
+        editorAppendUtf8(out, cp);
+        i += 2;
+    }
+    return i;
+}
+
+/**
+ * Decode a block of file data in 'encoding' into UTF-8 appended to 'out'.
+ * Bytes that can't be decoded yet are kept in 'carry' for the next block.
+ */
+static void editorDecode(int encoding, std::string &carry, const unsigned char *p, size_t n, std::string &out)
+{
+    if (encoding == ENC_UTF8)
+    {
+        out.append((const char *)p, n);
+        return;
+    }
+    if (encoding == ENC_LATIN1)
+    {
+        size_t i = 0;
+        while (i < n)
+        {
+            size_t run = editorAsciiRun(p + i, n - i);
+            out.append((const char *)p + i, run);
+            i += run;
+            if (i < n)
+                editorAppendUtf8(out, p[i++]);
+        }
+        return;
+    }
+
+    bool be = encoding == ENC_UTF16BE;
+    if (!carry.empty())
+    {
+        // Rare: a code unit or surrogate pair straddled the block boundary
+        carry.append((const char *)p, n);
+        std::string joined;
+        joined.swap(carry);
+        size_t used = editorDecodeUtf16((const unsigned char *)joined.data(), joined.size(), be, out);
+        carry.assign(joined, used, std::string::npos);
+        return;
+    }
+    size_t used = editorDecodeUtf16(p, n, be, out);
+    carry.assign((const char *)p + used, n - used);
+}
+
+/**
+ * At end of file, flush what editorDecode kept in 'carry': a high
+ * surrogate with nothing after it and an odd last byte each become
+ * U+FFFD, so the text shows that something was there.
+ */
+static void editorDecodeEnd(std::string &carry, std::string &out)
+{
+    for (size_t i = 0; i < carry.size(); i += 2)
+        editorAppendUtf8(out, 0xFFFD);
+    carry.clear();
+}
+
+/**
+ * Encode UTF-8 text as 'encoding', appending to 'out'. Characters that
+ * Latin-1 can't represent are written as '?'.
+ */
+static void editorEncode(int encoding, const char *data, size_t n, std::string &out)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t run = editorAsciiRun(p + i, n - i);
+        if (encoding == ENC_LATIN1)
+        {
+            out.append(data + i, run);
+        }
+        else
+        {
+            editorUtf16Widen(p + i, run, encoding == ENC_UTF16BE, out);
+        }
+        i += run;
+        if (i >= n)
+            break;
+
+        int cp = editorNextUtf8(p, n, &i);
+        if (cp == -1)
+        {
+            cp = p[i]; // Truncated sequence: keep the byte
+            i++;
+        }
+        if (encoding == ENC_LATIN1)
+        {
+            out += cp < 0x100 ? (char)cp : '?';
+            continue;
+        }
+
+        unsigned units[2] = {(unsigned)cp, 0};
+        int nunits = 1;
+        if (cp >= 0x10000)
+        {
+            units[0] = 0xD800 + ((cp - 0x10000) >> 10);
+            units[1] = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+            nunits = 2;
+        }
+        for (int k = 0; k < nunits; k++)
+        {
+            if (encoding == ENC_UTF16BE)
+            {
+                out += (char)(units[k] >> 8);
+                out += (char)(units[k] & 0xFF);
+            }
+            else
+            {
+                out += (char)(units[k] & 0xFF);
+                out += (char)(units[k] >> 8);
+            }
+        }
+    }
+}
+
+/*** file i/o ***/
+
+/**
+ * Read and decode the next block of the file into the loader's pending
+ * text. The first block also decides the file's encoding. Returns false
+ * at end of file.
+ */
+static bool editorLoaderFill()
+{
+    editorLoader &ld = E.loader;
+    ld.pending.erase(0, ld.pos);
+    ld.pos = 0;
+
+    unsigned char buf[BOLT_IO_BLOCK];
+    ssize_t n;
+    do
+    {
+        n = read(ld.fd, buf, sizeof(buf));
+    } while (n == -1 && errno == EINTR);
+    if (n <= 0)
+        return false;
+
+    // Keep the next few MB of the file on their way in, so that paging
+    // down past the loaded rows doesn't wait on the disk. Not before the
+    // first frame, which needs only the first block.
+    ld.offset += n;
+    if (ld.offset > BOLT_IO_BLOCK && ld.offset + BOLT_PREFETCH_BYTES / 2 > ld.prefetched)
+    {
+        posix_fadvise(ld.fd, ld.offset, BOLT_PREFETCH_BYTES, POSIX_FADV_WILLNEED);
+        ld.prefetched = ld.offset + BOLT_PREFETCH_BYTES;
+    }
+
+    size_t skip = 0;
+    if (!ld.detected)
+    {
+        skip = editorDetectEncoding(buf, (size_t)n, E.encoding, E.bom);
+        ld.detected = true;
+    }
+    editorDecode(E.encoding, ld.carry, buf + skip, (size_t)n - skip, ld.pending);
+    return true;
+}
+
+/**
+ * Read up to 'count' more rows from the active buffer's loader. Rows read
+ * from disk don't count as modifications, so the dirty flag is preserved.
+ */
+static void editorLoadRows(size_t count)
+{
+    editorLoader &ld = E.loader;
+    if (!ld.active)
+        return;
+
+    bool dirty = E.dirty;
+    while (count > 0)
+    {
+        size_t nl = ld.pending.find('\n', ld.pos);
+        if (nl == std::string::npos)
+        {
+            if (editorLoaderFill())
+                continue;
+
+            // End of file: whatever is left is a last line without a newline
+            editorDecodeEnd(ld.carry, ld.pending);
+            if (ld.pos < ld.pending.size())
+            {
+                editorInsertRow((int)E.rows.size(), ld.pending.substr(ld.pos), false);
+                E.no_eol = true;
+            }
+            close(ld.fd);
+            ld = editorLoader();
+            break;
+        }
+
+        size_t end = nl;
+        // Strip out any trailing carriage return
+        if (end > ld.pos && ld.pending[end - 1] == '\r')
+            end--;
+        editorInsertRow((int)E.rows.size(), ld.pending.substr(ld.pos, end - ld.pos), false);
+        ld.pos = nl + 1;
+        count--;
+    }
+    E.dirty = dirty;
+    editorCacheTrim();
+}
+
+/**
+ * Make sure at least 'n' rows are loaded (or the whole file, if shorter).
+ */
+static void editorEnsureRows(size_t n)
+{
+    if (E.rows.size() < n)
+        editorLoadRows(n - E.rows.size());
+}
+
+/**
+ * Finish loading the active buffer. Needed by anything that looks at the
+ * whole file, such as saving and searching.
+ */
+static void editorLoadAll()
+{
+    while (E.loader.active)
+        editorLoadRows(BOLT_LOAD_CHUNK);
+}
+
+/**
+ * The text of every loaded row, each followed by a newline.
+ */
+static std::string editorRowsToString()
+{
+    size_t len = 0;
+    for (const ERow &row : E.rows)
+        len += row.chars.size() + 1;
+    std::string out;
+    out.reserve(len);
+    for (const ERow &row : E.rows)
+    {
+        out += row.chars;
+        out += '\n';
+    }
+    return out;
+}
+
+/**
+ * Open a file into the active buffer. Only the rows needed for the current
+ * viewport (E.rowoff/E.cy, which a restored session may have set) are read
+ * here; the rest is streamed in by editorIdleWork().
+ */
+static bool editorOpen(const std::string &filename)
+{
+    E.loader.fd = open(filename.c_str(), O_RDONLY);
+    if (E.loader.fd == -1)
+        return false;
+    // Read once, front to back: a larger kernel readahead, and pages
+    // behind the loader can go first
+    posix_fadvise(E.loader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    E.loader.active = true;
+    boltProfilePhase("open file");
+
+    editorSetFilename(filename);
+    editorSelectSyntaxHighlight();
+    boltProfilePhase("select syntax");
+
+    editorEnsureRows((size_t)std::max(E.rowoff + E.screenrows, E.cy + 1));
+    E.dirty = false;
+    boltProfilePhase("read first screenful");
+
+    // Clamp a restored cursor to what the file actually contains
+    if (E.cy > (int)E.rows.size())
+        E.cy = (int)E.rows.size();
+    if (E.cy < (int)E.rows.size() && E.cx > (int)E.rows[E.cy].chars.size())
+        E.cx = (int)E.rows[E.cy].chars.size();
+    if (E.rowoff > E.cy)
+        E.rowoff = E.cy;
+    return true;
+}
+
+/*** buffers ***/
+
+/**
+ * True if the active buffer is the untouched empty buffer we start with,
+ * which opening a file may simply replace.
+ */
+static bool editorBufferIsScratch()
+{
+    return E.filename.empty() && E.rows.empty() && !E.dirty;
+}
+
+/**
+ * Park the active buffer at the back of E.buffers and make the front one
+ * active, so repeated calls cycle through every open buffer.
+ */
+static void editorNextBuffer()
+{
+    if (E.buffers.empty())
+        return;
+    editorBuffer &cur = E;
+    E.buffers.push_back(std::move(cur));
+    cur = std::move(E.buffers.front());
+    E.buffers.erase(E.buffers.begin());
+    editorEnsureRows((size_t)(E.rowoff + E.screenrows));
+}
+
+/**
+ * Open 'filename' in a new active buffer with the given cursor and scroll
+ * position. The previous buffer stays open in the background.
+ */
+static bool editorOpenBuffer(const std::string &filename, int cy, int cx, int rowoff, int coloff)
+{
+    editorBuffer &cur = E;
+    if (!editorBufferIsScratch())
+        E.buffers.push_back(std::move(cur));
+    cur = editorBuffer();
+    E.cy = cy;
+    E.cx = cx;
+    E.rowoff = rowoff;
+    E.coloff = coloff;
+
+    if (editorOpen(filename))
+        return true;
+
+    // Fall back to the buffer we came from
+    cur = editorBuffer();
+    if (!E.buffers.empty())
+    {
+        cur = std::move(E.buffers.back());
+        E.buffers.pop_back();
+    }
+    return false;
+}
+
+/**
+ * Switch to the buffer holding 'name', opening it if necessary.
+ */
+static bool editorSwitchToFile(const std::string &name)
+{
+    std::string abs = editorAbsolutePath(name);
+    for (size_t i = 0; i <= E.buffers.size(); i++)
+    {
+        if (!E.filename.empty() && (E.filename == name || E.path == abs))
+            return true;
+        editorNextBuffer();
+    }
+    if (editorOpenBuffer(name, 0, 0, 0, 0))
+        return true;
+    editorSetStatusMessage("Can't open %s: %s", name.c_str(), strerror(errno));
+    return false;
+}
+
+static void editorOpenPrompt()
+{
+    std::string name = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (!name.empty())
+        editorSwitchToFile(name);
+}
+
+static bool editorAnyDirty()
+{
+    if (E.dirty)
+        return true;
+    for (const auto &b : E.buffers)
+    {
+        if (b.dirty)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * True while any buffer still has rows waiting on disk.
+ */
+/**
+ * Render again the evicted rows of the screens just below and above the
+ * viewport, so paging onto them doesn't pay for it. Returns false if
+ * there were none.
+ */
+static bool editorCachePrefetch(bool dry_run = false)
+{
+    int rows = (int)E.rows.size();
+    int first = std::max(0, E.rowoff - E.screenrows);
+    int last = std::min(rows, E.rowoff + 2 * E.screenrows);
+    bool found = false;
+    for (int at = first; at < last; at++)
+    {
+        if (!E.rows[at].evicted)
+            continue;
+        if (dry_run)
+            return true;
+        editorRowCached(at);
+        found = true;
+    }
+    return found;
+}
+
+static bool editorIdlePending()
+{
+    if (E.loader.active || editorCachePrefetch(true))
+        return true;
+    for (const auto &b : E.buffers)
+    {
+        if (b.loader.active)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Load one chunk of rows while waiting for input. Evicted rows around the
+ * viewport are rendered first, then the active buffer is loaded, then
+ * background buffers are swapped in one at a time to be filled.
+ */
+static void editorIdleWork()
+{
+    if (editorCachePrefetch())
+        return;
+    if (E.loader.active)
+    {
+        editorLoadRows(BOLT_LOAD_CHUNK);
+        if (!E.loader.active)
+            editorRefreshScreen(); // Update the line count in the status bar
+        return;
+    }
+    editorBuffer &cur = E;
+    for (auto &b : E.buffers)
+    {
+        if (b.loader.active)
+        {
+            std::swap(cur, b);
+            editorLoadRows(BOLT_LOAD_CHUNK);
+            std::swap(cur, b);
+            return;
+        }
+    }
+}
+
+/*** session ***/
+
+/*
+ * One open file as remembered in the session file.
+ */
+struct editorSessionEntry
+{
+    std::string filename; // Absolute path
+    int cy, cx, rowoff, coloff;
+};
+
+static std::string editorSessionPath()
+{
+    const char *home = getenv("HOME");
+    return std::string(home ? home : ".") + "/" BOLT_SESSION_FILE;
+}
+
+static std::string editorAbsolutePath(const std::string &filename)
+{
+    char *abs = realpath(filename.c_str(), nullptr);
+    if (!abs)
+        return filename;
+    std::string result(abs);
+    free(abs);
+    return result;
+}
+
+static void editorSessionAppend(std::ostringstream &out, const editorBuffer &b)
+{
+    if (b.filename.empty())
+        return;
+    out << b.cy << ' ' << b.cx << ' ' << b.rowoff << ' ' << b.coloff << ' '
+        << editorAbsolutePath(b.filename) << '\n';
+}
+
+/**
+ * Write the open buffers and their positions to the session file. The file
+ * is written to a temporary name and renamed into place, so a crash never
+ * leaves a truncated session behind.
+ */
+static void editorSaveSession()
+{
+    std::ostringstream out;
+    out << "bolt-session 1\n";
+    editorSessionAppend(out, E);
+    for (const auto &b : E.buffers)
+    {
+        editorSessionAppend(out, b);
+    }
+    std::string data = out.str();
+
+    std::string path = editorSessionPath();
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+        return;
+    bool ok = write(fd, data.data(), data.size()) == (ssize_t)data.size() && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) == -1)
+        unlink(tmp.c_str());
+}
+
+static std::vector<editorSessionEntry> editorReadSession()
+{
+    std::vector<editorSessionEntry> entries;
+    std::ifstream in(editorSessionPath());
+    std::string line;
+    if (!std::getline(in, line) || line != "bolt-session 1")
+        return entries;
+
+    while (std::getline(in, line))
+    {
+        editorSessionEntry e;
+        int consumed = 0;
+        if (sscanf(line.c_str(), "%d %d %d %d %n", &e.cy, &e.cx, &e.rowoff, &e.coloff, &consumed) != 4 ||
+            consumed == 0)
+            continue;
+        e.filename = line.substr(consumed);
+        entries.push_back(e);
+    }
+    return entries;
+}
+
+/**
+ * Open each of 'files' (or, if empty, everything from the last session),
+ * restoring remembered positions. The first file ends up active.
+ */
+static void editorRestoreSession(const std::vector<std::string> &files)
+{
+    std::vector<editorSessionEntry> session = editorReadSession();
+    boltProfilePhase("read session");
+
+    if (files.empty())
+    {
+        for (const auto &e : session)
+        {
+            if (access(e.filename.c_str(), R_OK) == 0)
+                editorOpenBuffer(e.filename, e.cy, e.cx, e.rowoff, e.coloff);
+        }
+    }
+    else
+    {
+        for (const auto &f : files)
+        {
+            std::string abs = editorAbsolutePath(f);
+            editorSessionEntry pos = {abs, 0, 0, 0, 0};
+            for (const auto &e : session)
+            {
+                if (e.filename == abs)
+                    pos = e;
+            }
+            if (!editorOpenBuffer(f, pos.cy, pos.cx, pos.rowoff, pos.coloff))
+                die(("fopen: " + f).c_str());
+        }
+    }
+    // The last file opened is active; rotate the first one to the front
+    editorNextBuffer();
+}
+
+/*
+ * Streaming save pipeline. Each row passes through the save transforms
+ * and is queued as an iovec. Rows the transforms leave alone point
+ * straight at the row's own text, so only changed rows are copied.
+ */
+struct editorSaveWriter
+{
+    int fd;
+    std::vector<struct iovec> iov;
+    std::deque<std::string> scratch; // Transformed rows; deque keeps them in place
+    std::string encoded;             // Output being transcoded from UTF-8
+    size_t total = 0;
+    bool ok = true;
+};
+
+static void editorSaveFlush(editorSaveWriter &w)
+{
+    size_t first = 0;
+    while (w.ok && first < w.iov.size())
+    {
+        int count = (int)std::min(w.iov.size() - first, (size_t)BOLT_SAVE_IOV);
+        ssize_t n = writev(w.fd, &w.iov[first], count);
+        if (n == -1)
+        {
+            if (errno != EINTR)
+                w.ok = false;
+            continue;
+        }
+        w.total += (size_t)n;
+        // Skip fully written iovecs and trim a partially written one
+        while (first < w.iov.size() && (size_t)n >= w.iov[first].iov_len)
+            n -= (ssize_t)w.iov[first++].iov_len;
+        if (n > 0)
+        {
+            w.iov[first].iov_base = (char *)w.iov[first].iov_base + n;
+            w.iov[first].iov_len -= (size_t)n;
+        }
+    }
+    w.iov.clear();
+    w.scratch.clear();
+}
+
+static void editorSaveQueue(editorSaveWriter &w, const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+    w.iov.push_back({(void *)data, len});
+    if (w.iov.size() >= BOLT_SAVE_IOV)
+        editorSaveFlush(w);
+}
+
+/**
+ * Hand the transcoded output collected so far to the writer.
+ */
+static void editorSaveQueueEncoded(editorSaveWriter &w)
+{
+    if (w.encoded.empty())
+        return;
+    w.scratch.push_back(std::string());
+    w.scratch.back().swap(w.encoded);
+    editorSaveQueue(w, w.scratch.back().data(), w.scratch.back().size());
+}
+
+/**
+ * Queue UTF-8 text for writing. Files in another encoding are transcoded
+ * in blocks; UTF-8 files are written straight from the row text.
+ */
+static void editorSavePush(editorSaveWriter &w, const char *data, size_t len)
+{
+    if (E.encoding == ENC_UTF8)
+    {
+        editorSaveQueue(w, data, len);
+        return;
+    }
+    editorEncode(E.encoding, data, len, w.encoded);
+    if (w.encoded.size() >= BOLT_IO_BLOCK)
+        editorSaveQueueEncoded(w);
+}
+
+/**
+ * Apply the save transforms to one row and queue the result.
+ */
+static void editorSaveRow(editorSaveWriter &w, const ERow &row)
+{
+    const editorSaveOptions &opts = E.save_opts;
+
+    // 'render' is exactly the row with its tabs expanded. A row whose
+    // render was evicted is expanded here rather than rendered again, so
+    // saving doesn't fill the cache.
+    const std::string *src = &row.chars;
+    if (opts.tabs == SAVE_TABS_EXPAND && row.tabs && !row.evicted)
+        src = &row.render;
+    else if (opts.tabs == SAVE_TABS_EXPAND && row.tabs)
+    {
+        w.scratch.emplace_back();
+        std::string &expanded = w.scratch.back();
+        for (char c : row.chars)
+        {
+            if (c != '\t')
+                expanded += c;
+            else
+                expanded.append(KILO_TAB_STOP - expanded.size() % KILO_TAB_STOP, ' ');
+        }
+        src = &expanded;
+    }
+
+    size_t len = src->size();
+    if (opts.strip_trailing)
+    {
+        size_t end = src->find_last_not_of(" \t");
+        len = end == std::string::npos ? 0 : end + 1;
+    }
+
+    if (opts.tabs == SAVE_TABS_UNEXPAND && len > (size_t)row.indent_len)
+    {
+        std::string indent(row.indent_width / KILO_TAB_STOP, '\t');
+        indent.append(row.indent_width % KILO_TAB_STOP, ' ');
+        if (row.chars.compare(0, row.indent_len, indent) != 0)
+        {
+            w.scratch.push_back(indent);
+            w.scratch.back().append(row.chars, row.indent_len, len - row.indent_len);
+            editorSavePush(w, w.scratch.back().data(), w.scratch.back().size());
+            return;
+        }
+    }
+    editorSavePush(w, src->data(), len);
+}
+
+/**
+ * Save the current text buffer to disk. If no filename is set, prompt for one.
+ */
+static void editorSave()
+{
+    if (E.filename.empty())
+    {
+        std::string newName = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        if (newName.empty())
+        {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSetFilename(newName);
+        editorSelectSyntaxHighlight();
+    }
+    editorLoadAll();
+
+    editorSaveWriter w;
+    w.fd = open(E.filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w.fd == -1)
+    {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+        return;
+    }
+
+    if (E.bom)
+    {
+        static const char bom[] = "\xEF\xBB\xBF";
+        std::string encoded_bom;
+        editorEncode(E.encoding, bom, 3, encoded_bom);
+        w.scratch.push_back(E.encoding == ENC_UTF8 ? std::string(bom) : encoded_bom);
+        editorSaveQueue(w, w.scratch.back().data(), w.scratch.back().size());
+    }
+
+    static const char newline = '\n';
+    bool final_newline = E.save_opts.final_newline || !E.no_eol;
+    for (size_t i = 0; i < E.rows.size(); i++)
+    {
+        editorSaveRow(w, E.rows[i]);
+        if (i + 1 < E.rows.size() || final_newline)
+            editorSavePush(w, &newline, 1);
+    }
+    editorSaveQueueEncoded(w);
+    editorSaveFlush(w);
+    int saved_errno = errno;
+    close(w.fd);
+
+    if (!w.ok)
+    {
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(saved_errno));
+        return;
+    }
+    E.no_eol = !final_newline;
+    E.dirty = false;
+    for (ERow &row : E.rows)
+        row.shade[SHADE_MODIFIED] = 0;
+    editorIndexDropShades();
+    if (E.path.empty() || E.path[0] != '/')
+        editorSetFilename(E.filename); // A new file only resolves once it exists
+    editorSetStatusMessage("%lu bytes written to disk", (unsigned long)w.total);
+}
+
+/*** find ***/
+static void editorFindCallback(std::string &query, int key) {
+    int &last_match = E.find_last_match;
+    int &direction = E.find_direction;
+
+    if (key == '\r' || key == '\x1b')
+    {
+        last_match = -1;
+        direction = 1;
+        E.find_query.clear();
+        E.find_row = -1;
+        E.match_query.clear();
+        if (key == '\x1b')
+            E.match_rows.clear();
+        return;
+    } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
+        direction = 1;
+    } else if (key == ARROW_LEFT || key == ARROW_UP) {
+        direction = -1;
+    } else {
+        last_match = -1;
+        direction = 1;
+
+        // The query changed: collect every matching row for the overview
+        // ruler. A query containing the last one can only match rows that
+        // matched it, so while the user types on only those are searched
+        if (!E.match_query.empty() && query.find(E.match_query) != std::string::npos)
+        {
+            size_t n = 0;
+            for (int row : E.match_rows)
+            {
+                if (E.rows[row].chars.find(query) != std::string::npos)
+                    E.match_rows[n++] = row;
+            }
+            E.match_rows.resize(n);
+        }
+        else
+        {
+            E.match_rows.clear();
+            for (size_t i = 0; i < E.rows.size() && !query.empty(); i++)
+            {
+                if (E.rows[i].chars.find(query) != std::string::npos)
+                    E.match_rows.push_back((int)i);
+            }
+        }
+        E.match_query = query;
+    }
+
+    // Matches are drawn as overlays; the rows' highlighting is left alone
+    E.find_query = query;
+    E.find_row = -1;
+    if (last_match == -1) direction = 1;
+    int current = last_match;
+
+    for (size_t i = 0; i < E.rows.size() && !query.empty(); i++){
+        current += direction;
+        if (current == -1){
+            current = E.rows.size() - 1;
+        } 
+        else if (current == int(E.rows.size())){
+            current = 0;
+        }
+        size_t pos = E.rows[current].chars.find(query);
+        if (pos != std::string::npos) {
+            last_match = current;
+            E.cy = current;
+            E.cx = static_cast<int>(pos);
+            E.rowoff = E.rows.size();
+            E.find_row = current;
+            E.find_col = static_cast<int>(pos);
+            break;
+        }
+    }
+}
+
+static void editorFind() {
+    editorLoadAll();
+    int saved_cx = E.cx;
+    int saved_cy = E.cy;
+    int saved_coloff = E.coloff;
+    int saved_rowoff = E.rowoff;
+
+    std::string query = editorPrompt("Search: %s (ESC to cancel)", editorFindCallback);
+
+    if (query.empty()){
+        E.cx = saved_cx;
+        E.cy = saved_cy;
+        E.coloff = saved_coloff;
+        E.rowoff = saved_rowoff;
+    }
+}
+
+/*** locations ***/
+
+static const char *editorParseNumber(const char *p, int &value)
+{
+    value = 0;
+    while (*p >= '0' && *p <= '9')
+    {
+        if (value < 100000000)
+            value = value * 10 + (*p - '0');
+        p++;
+    }
+    return p;
+}
+
+/**
+ * Anchor the locations that point into buffer 'b', replacing those of an
+ * earlier errors list. From then on they move with edits to it, so the
+ * underlines stay on the code they were reported for.
+ */
+static void editorAnchorDiagnostics(editorBuffer &b)
+{
+    b.diagnostics = editorAnchors();
+    b.diagnostic_ids.assign(b.path.empty() ? 0 : E.errors.size(), -1);
+    b.diagnostic_line.clear();
+    for (size_t i = 0; i < b.diagnostic_ids.size(); i++)
+    {
+        const editorLocation &loc = E.errors[i];
+        if (loc.path != b.path)
+            continue;
+        int id = editorAnchorAdd(b.diagnostics, loc.line - 1, std::max(loc.col - 1, 0));
+        if (id >= (int)b.diagnostic_line.size())
+            b.diagnostic_line.resize(id + 1);
+        b.diagnostic_line[id] = loc.col == 0;
+        b.diagnostic_ids[i] = id;
+    }
+}
+
+/**
+ * Name the active buffer 'filename', resolving its absolute path once,
+ * and anchor the locations that point into it.
+ */
+static void editorSetFilename(const std::string &filename)
+{
+    E.filename = filename;
+    E.path = editorAbsolutePath(filename);
+    editorAnchorDiagnostics(E);
+}
+
+/**
+ * Recognise "file:line:", "file:line:col:" and grep's "file:line:text".
+ * The file name may not contain spaces, which keeps lines such as
+ * "In file included from x.h:3:" and "make: ***" out of the index.
+ */
+static bool editorParseLocation(const std::string &text, editorLocation &loc)
+{
+    const char *s = text.c_str();
+    const char *p = s;
+    while (*p == ' ' || *p == '\t')
+        p++;
+    const char *start = p;
+    while (*p && *p != ' ' && *p != '\t' && !(p[0] == ':' && p[1] >= '0' && p[1] <= '9'))
+        p++;
+    if (p == start || *p != ':')
+        return false;
+    const char *end = p;
+
+    int line, col = 0;
+    p = editorParseNumber(p + 1, line);
+    if (*p != ':' || line == 0)
+        return false;
+    if (p[1] >= '0' && p[1] <= '9')
+    {
+        const char *q = editorParseNumber(p + 1, col);
+        if (*q != ':' && *q != '\0')
+            col = 0; // "file:12:34 text" from grep: 34 is part of the text
+    }
+
+    loc.file.assign(start, end - start);
+    loc.line = line;
+    loc.col = col;
+    return true;
+}
+
+/**
+ * Index every location in the active buffer and make it the errors buffer.
+ */
+static void editorParseErrors()
+{
+    editorLoadAll();
+    E.errors.clear();
+    E.error_index = -1;
+    std::map<std::string, std::string> paths; // Each file named is resolved once
+    for (int i = 0; i < (int)E.rows.size(); i++)
+    {
+        editorLocation loc;
+        if (editorParseLocation(E.rows[i].chars, loc))
+        {
+            loc.row = i;
+            auto it = paths.find(loc.file);
+            if (it == paths.end())
+                it = paths.emplace(loc.file, editorAbsolutePath(loc.file)).first;
+            loc.path = it->second;
+            E.errors.push_back(std::move(loc));
+        }
+    }
+    E.errors_list = true;
+    editorAnchorDiagnostics(E);
+    for (editorBuffer &b : E.buffers)
+        editorAnchorDiagnostics(b);
+    editorSetStatusMessage("%d locations", (int)E.errors.size());
+}
+
+/**
+ * Put the cursor on 'line' (1-based) and 'col' (1-based, 0 for the start
+ * of the line), loading the file up to there if needed.
+ */
+static void editorGotoLine(int line, int col)
+{
+    editorEnsureRows((size_t)line);
+    E.cy = std::min(std::max(line - 1, 0), std::max((int)E.rows.size() - 1, 0));
+    E.cx = 0;
+    if (E.cy < (int)E.rows.size())
+        E.cx = std::min(std::max(col - 1, 0), (int)E.rows[E.cy].chars.size());
+}
+
+/**
+ * Open the file of location 'index' through the buffer list and go to it,
+ * following its anchor if the file has been edited since.
+ */
+static void editorJumpToError(int index)
+{
+    if (index < 0 || index >= (int)E.errors.size())
+        return;
+    E.error_index = index;
+    editorLocation loc = E.errors[index];
+    if (!editorSwitchToFile(loc.file))
+        return;
+    int id = index < (int)E.diagnostic_ids.size() ? E.diagnostic_ids[index] : -1;
+    if (id >= 0)
+    {
+        int row, col;
+        editorAnchorPos(E.diagnostics, id, row, col);
+        editorGotoLine(row + 1, E.diagnostic_line[id] ? 0 : col + 1);
+    }
+    else
+    {
+        editorGotoLine(loc.line, loc.col);
+    }
+    editorSetStatusMessage("[%d/%d] %s:%d", index + 1, (int)E.errors.size(), loc.file.c_str(), loc.line);
+}
+
+/**
+ * In the errors buffer, jump to the location on (or after) the cursor row.
+ * Anywhere else, parse the current buffer as an errors list first.
+ */
+static void editorErrorsHere()
+{
+    if (!E.errors_list)
+    {
+        editorParseErrors();
+        editorJumpToError(0);
+        return;
+    }
+    auto it = std::lower_bound(E.errors.begin(), E.errors.end(), E.cy,
+                               [](const editorLocation &loc, int row) { return loc.row < row; });
+    if (it == E.errors.end())
+    {
+        editorSetStatusMessage("No location on or after this line");
+        return;
+    }
+    editorJumpToError((int)(it - E.errors.begin()));
+}
+
+static void editorNextError(int direction)
+{
+    if (E.errors.empty())
+    {
+        editorSetStatusMessage("No errors list (Ctrl-E parses the current buffer)");
+        return;
+    }
+    int next = E.error_index + direction;
+    if (next < 0 || next >= (int)E.errors.size())
+    {
+        editorSetStatusMessage("No more locations");
+        return;
+    }
+    editorJumpToError(next);
+}
+
+/**
+ * Show piped text in a new unnamed buffer and index it as an errors list.
+ */
+static void editorOpenErrorsText(const std::string &text)
+{
+    editorBuffer &cur = E;
+    if (!editorBufferIsScratch())
+        E.buffers.push_back(std::move(cur));
+    cur = editorBuffer();
+
+    size_t start = 0;
+    while (start < text.size())
+    {
+        size_t nl = text.find('\n', start);
+        size_t end = nl == std::string::npos ? text.size() : nl;
+        size_t len = end - start;
+        if (len > 0 && text[end - 1] == '\r')
+            len--;
+        editorInsertRow((int)E.rows.size(), text.substr(start, len), false);
+        start = end + 1;
+    }
+    E.dirty = false;
+    editorParseErrors();
+}
+
+/*** marks ***/
+
+/**
+ * Move the cursor to where anchor 'id' of 'a' is now.
+ */
+static void editorJumpToAnchor(editorAnchors &a, int id)
+{
+    int row, col;
+    editorAnchorPos(a, id, row, col);
+    editorGotoLine(row + 1, col + 1);
+    E.sel_active = false;
+}
+
+/**
+ * Set a bookmark at the cursor, or clear the one already on its row.
+ */
+static void editorToggleBookmark()
+{
+    if (E.cy >= (int)E.rows.size())
+        return;
+    int id = editorAnchorLowerBound(E.bookmarks, E.cy, INT_MIN);
+    if (id >= 0 && E.bookmarks.nodes[id].row == E.cy)
+    {
+        editorAnchorRemove(E.bookmarks, id);
+        editorSetStatusMessage("Bookmark cleared (%d left)", E.bookmarks.count);
+        return;
+    }
+    editorAnchorAdd(E.bookmarks, E.cy, E.cx);
+    editorSetStatusMessage("Bookmark set (%d in buffer)", E.bookmarks.count);
+}
+
+/**
+ * Jump to the next (direction = 1) or previous (-1) bookmark, wrapping
+ * around the ends of the buffer.
+ */
+static void editorNextBookmark(int direction)
+{
+    editorAnchors &a = E.bookmarks;
+    if (a.count == 0)
+    {
+        editorSetStatusMessage("No bookmarks");
+        return;
+    }
+    int id = direction > 0 ? editorAnchorLowerBound(a, E.cy + 1, INT_MIN)
+                           : editorAnchorLastBefore(a, E.cy, INT_MIN);
+    if (id < 0)
+        id = direction > 0 ? editorAnchorLowerBound(a, INT_MIN, INT_MIN)
+                           : editorAnchorLastBefore(a, INT_MAX, INT_MAX);
+    editorJumpToAnchor(a, id);
+}
+
+/**
+ * Prompt for a mark name; only its first character counts.
+ */
+static char editorPromptMark(const char *prompt)
+{
+    std::string name = editorPrompt(prompt, nullptr);
+    return name.empty() ? '\0' : name[0];
+}
+
+static void editorSetMark()
+{
+    char name = editorPromptMark("Set mark: %s (ESC to cancel)");
+    if (!name)
+        return;
+    auto it = E.mark_ids.find(name);
+    if (it != E.mark_ids.end())
+        editorAnchorRemove(E.marks, it->second);
+    E.mark_ids[name] = editorAnchorAdd(E.marks, E.cy, E.cx);
+    editorSetStatusMessage("Mark '%c' set", name);
+}
+
+static void editorJumpToMark()
+{
+    char name = editorPromptMark("Jump to mark: %s (ESC to cancel)");
+    if (!name)
+        return;
+    auto it = E.mark_ids.find(name);
+    if (it == E.mark_ids.end())
+    {
+        editorSetStatusMessage("No mark '%c'", name);
+        return;
+    }
+    editorJumpToAnchor(E.marks, it->second);
+}
+
+/*** append buffer for rendering ***/
+
+/*
+ * A small struct for building output strings more efficiently,
+ * similar to a dynamic string or std::stringstream usage.
+ */
+struct abuf
+{
+    std::string b;
+};
+
+/**
+ * Append a string 's' of length 'len' to abuf 'ab'.
+ */
+static void abAppend(abuf &ab, const char *s, int len)
+{
+    ab.b.append(s, len);
+}
+
+/**
+ * Append a C-string (null-terminated) to abuf 'ab'.
+ */
+static void abAppend(abuf &ab, const char *s)
+{
+    ab.b.append(s);
+}
+
+/*** theme ***/
+
+/*
+ * Colours are COLOR_DEFAULT, a palette index (0-255) or a 24-bit value
+ * made with COLOR_RGB.
+ */
+#define COLOR_DEFAULT -1
+#define COLOR_RGB(r, g, b) (0x1000000 | ((r) << 16) | ((g) << 8) | (b))
+#define COLOR_IS_RGB(c) ((c) >= 0x1000000)
+
+enum editorAttr
+{
+    ATTR_BOLD = 1 << 0,
+    ATTR_ITALIC = 1 << 1,
+    ATTR_UNDERLINE = 1 << 2,
+    ATTR_REVERSE = 1 << 3,
+};
+
+/*
+ * One face per highlight class (in editorHighlight order), then the faces
+ * of overlays and the rest of the screen.
+ */
+enum editorFaceId
+{
+    FACE_SELECTION = HL_MATCH + 1,
+    FACE_CURRENT_MATCH,
+    FACE_BRACKET,
+    FACE_DIAGNOSTIC,
+    FACE_BOOKMARK,
+    FACE_MODIFIED,
+    FACE_STATUS,
+    FACE_COUNT
+};
+
+static const char *editorFaceNames[FACE_COUNT] = {
+    "normal", "comment", "keyword1", "keyword2", "string", "number", "match",
+    "selection", "current-match", "bracket", "diagnostic", "bookmark", "modified", "status",
+};
+
+struct editorFace
+{
+    int fg = COLOR_DEFAULT, bg = COLOR_DEFAULT;
+    int attrs = 0;
+    std::string fg_sgr, bg_sgr; // SGR parameters, compiled when the face is set
+};
+
+struct editorTheme
+{
+    std::array<editorFace, FACE_COUNT> faces;
+    bool truecolor = false; // Otherwise 24-bit colours map onto the 256-colour cube
+};
+
+static thread_local editorTheme *bound_theme;
+#define theme (*bound_theme)
+
+static std::string editorCompileColor(int color, bool bg)
+{
+    char buf[24];
+    if (color == COLOR_DEFAULT)
+        return bg ? "49" : "39";
+    if (COLOR_IS_RGB(color) && !theme.truecolor)
+    {
+        // Nearest colour of the 6x6x6 cube
+        int r = (color >> 16) & 0xff, g = (color >> 8) & 0xff, b = color & 0xff;
+        color = 16 + 36 * ((r * 5 + 127) / 255) + 6 * ((g * 5 + 127) / 255) + (b * 5 + 127) / 255;
+    }
+    if (COLOR_IS_RGB(color))
+        snprintf(buf, sizeof(buf), "%d;2;%d;%d;%d", bg ? 48 : 38,
+                 (color >> 16) & 0xff, (color >> 8) & 0xff, color & 0xff);
+    else if (color < 8)
+        snprintf(buf, sizeof(buf), "%d", (bg ? 40 : 30) + color);
+    else if (color < 16)
+        snprintf(buf, sizeof(buf), "%d", (bg ? 100 : 90) + color - 8);
+    else
+        snprintf(buf, sizeof(buf), "%d;5;%d", bg ? 48 : 38, color);
+    return buf;
+}
+
+static void editorSetFace(int id, int fg, int bg, int attrs)
+{
+    editorFace &f = theme.faces[id];
+    f.fg = fg;
+    f.bg = bg;
+    f.attrs = attrs;
+    f.fg_sgr = editorCompileColor(fg, false);
+    f.bg_sgr = editorCompileColor(bg, true);
+}
+
+/**
+ * The colours Bolt has always used, in the basic eight-colour palette.
+ */
+static void editorDefaultTheme()
+{
+    const char *colorterm = getenv("COLORTERM");
+    theme.truecolor = colorterm && (!strcmp(colorterm, "truecolor") || !strcmp(colorterm, "24bit"));
+
+    for (int id = 0; id < FACE_COUNT; id++)
+        editorSetFace(id, COLOR_DEFAULT, COLOR_DEFAULT, 0);
+    editorSetFace(HL_COMMENT, 6, COLOR_DEFAULT, 0);
+    editorSetFace(HL_KEYWORD1, 3, COLOR_DEFAULT, 0);
+    editorSetFace(HL_KEYWORD2, 2, COLOR_DEFAULT, 0);
+    editorSetFace(HL_STRING, 5, COLOR_DEFAULT, 0);
+    editorSetFace(HL_NUMBER, 1, COLOR_DEFAULT, 0);
+    editorSetFace(HL_MATCH, 4, COLOR_DEFAULT, 0);
+    editorSetFace(FACE_SELECTION, COLOR_DEFAULT, COLOR_DEFAULT, ATTR_REVERSE);
+    editorSetFace(FACE_CURRENT_MATCH, 4, COLOR_DEFAULT, ATTR_REVERSE);
+    editorSetFace(FACE_BRACKET, COLOR_DEFAULT, COLOR_DEFAULT, ATTR_BOLD | ATTR_UNDERLINE);
+    editorSetFace(FACE_DIAGNOSTIC, COLOR_DEFAULT, COLOR_DEFAULT, ATTR_UNDERLINE);
+    editorSetFace(FACE_BOOKMARK, 2, COLOR_DEFAULT, 0);
+    editorSetFace(FACE_MODIFIED, 3, COLOR_DEFAULT, 0);
+    editorSetFace(FACE_STATUS, COLOR_DEFAULT, COLOR_DEFAULT, ATTR_REVERSE);
+}
+
+/**
+ * Parse "default", a colour name ("red", "bright-blue"), a palette
+ * index (0-255) or "#rrggbb".
+ */
+static bool editorParseColor(const std::string &s, int &color)
+{
+    static const char *names[] = {"black", "red", "green", "yellow", "blue", "magenta", "cyan", "white"};
+    if (s == "default")
+    {
+        color = COLOR_DEFAULT;
+        return true;
+    }
+    if (s.size() == 7 && s[0] == '#' && s.find_first_not_of("0123456789abcdefABCDEF", 1) == std::string::npos)
+    {
+        int rgb = (int)strtol(s.c_str() + 1, nullptr, 16);
+        color = COLOR_RGB((rgb >> 16) & 0xff, (rgb >> 8) & 0xff, rgb & 0xff);
+        return true;
+    }
+    if (!s.empty() && s.size() <= 3 && s.find_first_not_of("0123456789") == std::string::npos)
+    {
+        color = atoi(s.c_str());
+        return color <= 255;
+    }
+    bool bright = s.compare(0, 7, "bright-") == 0;
+    for (int i = 0; i < 8; i++)
+    {
+        if (s.compare(bright ? 7 : 0, std::string::npos, names[i]) == 0)
+        {
+            color = i + (bright ? 8 : 0);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Define a face from words[first] (its name) and the specs after it:
+ * fg=<colour>, bg=<colour>, bold, italic, underline, reverse. Anything
+ * not given is reset to the terminal's default.
+ */
+static bool editorThemeLine(const std::vector<std::string> &words, size_t first)
+{
+    if (first >= words.size())
+        return false;
+    int id = -1;
+    for (int i = 0; i < FACE_COUNT; i++)
+    {
+        if (words[first] == editorFaceNames[i])
+            id = i;
+    }
+    if (id < 0)
+        return false;
+
+    static const struct
+    {
+        const char *name;
+        int attr;
+    } attrs[] = {{"bold", ATTR_BOLD}, {"italic", ATTR_ITALIC}, {"underline", ATTR_UNDERLINE}, {"reverse", ATTR_REVERSE}};
+    int fg = COLOR_DEFAULT, bg = COLOR_DEFAULT, attr = 0;
+    for (size_t i = first + 1; i < words.size(); i++)
+    {
+        const std::string &w = words[i];
+        bool known = false;
+        if (w.compare(0, 3, "fg=") == 0)
+            known = editorParseColor(w.substr(3), fg);
+        else if (w.compare(0, 3, "bg=") == 0)
+            known = editorParseColor(w.substr(3), bg);
+        for (const auto &a : attrs)
+        {
+            if (w == a.name)
+            {
+                attr |= a.attr;
+                known = true;
+            }
+        }
+        if (!known)
+            return false;
+    }
+    editorSetFace(id, fg, bg, attr);
+    return true;
+}
+
+/**
+ * Load a theme file: one "<face> <spec>..." line per face, as for
+ * editorThemeLine. Returns false if the file can't be read.
+ */
+static bool editorLoadTheme(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line))
+    {
+        lineno++;
+        std::istringstream words_in(line);
+        std::vector<std::string> words;
+        std::string w;
+        while (words_in >> w)
+            words.push_back(w);
+        if (words.empty() || words[0][0] == '#')
+            continue;
+        if (!editorThemeLine(words, 0))
+            editorSetStatusMessage("%s:%d: bad face: %s", path.c_str(), lineno, line.c_str());
+    }
+    return true;
+}
+
+/*
+ * What the terminal is drawing with, so that only the differences to
+ * the next cell's face have to be sent.
+ */
+struct editorPen
+{
+    int fg = COLOR_DEFAULT, bg = COLOR_DEFAULT;
+    int attrs = 0;
+};
+
+/**
+ * Switch the pen to the foreground of 'fg', the background of 'bg' and
+ * 'attrs', in a single SGR sequence holding only what changed.
+ */
+static void editorPenSet(abuf &ab, editorPen &pen, const editorFace &fg, const editorFace &bg, int attrs)
+{
+    static const struct
+    {
+        int attr;
+        const char *on, *off;
+    } sgr[] = {{ATTR_BOLD, "1", "22"}, {ATTR_ITALIC, "3", "23"}, {ATTR_UNDERLINE, "4", "24"}, {ATTR_REVERSE, "7", "27"}};
+
+    if (pen.fg == fg.fg && pen.bg == bg.bg && pen.attrs == attrs)
+        return;
+    if (fg.fg == COLOR_DEFAULT && bg.bg == COLOR_DEFAULT && attrs == 0)
+    {
+        abAppend(ab, "\x1b[m", 3); // A full reset is never longer
+        pen = editorPen();
+        return;
+    }
+
+    std::string seq = "\x1b[";
+    auto add = [&seq](const std::string &param) {
+        if (seq.size() > 2)
+            seq += ';';
+        seq += param;
+    };
+    if (pen.fg != fg.fg)
+        add(fg.fg_sgr);
+    if (pen.bg != bg.bg)
+        add(bg.bg_sgr);
+    for (const auto &a : sgr)
+    {
+        if ((pen.attrs & a.attr) != (attrs & a.attr))
+            add(attrs & a.attr ? a.on : a.off);
+    }
+    seq += 'm';
+    abAppend(ab, seq.c_str(), (int)seq.size());
+    pen.fg = fg.fg;
+    pen.bg = bg.bg;
+    pen.attrs = attrs;
+}
+
+static void editorPenFace(abuf &ab, editorPen &pen, int id, int extra_attrs = 0)
+{
+    const editorFace &f = theme.faces[id];
+    editorPenSet(ab, pen, f, f, f.attrs | extra_attrs);
+}
+
+/*** screen ***/
+
+/*
+ * Frames are drawn into a grid of cells, then sent as the difference from
+ * what the terminal already shows. A cell holds one byte of rendered text
+ * and the faces its colours come from.
+ */
+struct editorCell
+{
+    char ch = '\0'; // '\0' marks a cell whose contents on screen are unknown
+    unsigned char fg = HL_NORMAL, bg = HL_NORMAL;
+    unsigned char attrs = 0;
+
+    bool operator==(const editorCell &o) const
+    {
+        return ch == o.ch && fg == o.fg && bg == o.bg && attrs == o.attrs;
+    }
+    bool operator!=(const editorCell &o) const { return !(*this == o); }
+};
+
+struct editorScreen
+{
+    int rows = 0, cols = 0;
+    std::vector<editorCell> cells; // The frame being drawn
+    std::vector<editorCell> shown; // What the terminal shows
+    int rowoff = 0;                // E.rowoff when 'shown' was drawn
+    int cy = -1, cx = -1;          // Terminal cursor, -1 when unknown
+    std::string frame;             // The bytes of the last frame
+};
+
+static thread_local editorScreen *bound_screen;
+#define screen (*bound_screen)
+
+/**
+ * Start a frame: clear the grid to blank, resizing it (and forgetting
+ * what is on screen) if the window size changed.
+ */
+static void editorScreenBegin(int rows, int cols)
+{
+    editorCell blank;
+    blank.ch = ' ';
+    if (rows != screen.rows || cols != screen.cols)
+    {
+        screen.rows = rows;
+        screen.cols = cols;
+        screen.shown.assign((size_t)rows * cols, editorCell());
+        screen.cy = screen.cx = -1;
+    }
+    screen.cells.assign((size_t)rows * cols, blank);
+}
+
+static editorCell *editorScreenRow(std::vector<editorCell> &grid, int y)
+{
+    return &grid[(size_t)y * screen.cols];
+}
+
+static void editorScreenPut(int y, int x, char ch, int fg, int bg, int attrs)
+{
+    if (y < 0 || y >= screen.rows || x < 0 || x >= screen.cols)
+        return;
+    editorCell &c = editorScreenRow(screen.cells, y)[x];
+    c.ch = ch;
+    c.fg = (unsigned char)fg;
+    c.bg = (unsigned char)bg;
+    c.attrs = (unsigned char)attrs;
+}
+
+/**
+ * Write 'len' bytes of 's' from (y, x) in face 'face', clipped to the row.
+ * Returns the column after the text.
+ */
+static int editorScreenText(int y, int x, const char *s, int len, int face)
+{
+    for (int i = 0; i < len; i++, x++)
+        editorScreenPut(y, x, s[i], face, face, theme.faces[face].attrs);
+    return x;
+}
+
+/**
+ * A blank cell that EL and ECH can produce with the pen in the normal face.
+ */
+static bool editorCellErasable(const editorCell &c)
+{
+    return c.ch == ' ' && theme.faces[c.bg].bg == theme.faces[HL_NORMAL].bg &&
+           !(c.attrs & (ATTR_REVERSE | ATTR_UNDERLINE));
+}
+
+static void editorAppendCsi(std::string &out, int n, char final)
+{
+    char buf[16];
+    int len = n == 1 ? snprintf(buf, sizeof(buf), "\x1b[%c", final)
+                     : snprintf(buf, sizeof(buf), "\x1b[%d%c", n, final);
+    out.append(buf, len);
+}
+
+/**
+ * The shortest sequence moving the cursor from where it is to (y, x):
+ * absolute positioning, or a relative move built from CR, LF and the
+ * CUU/CUD/CUF/CUB sequences. The horizontal part comes first so that a
+ * CR also ends any pending wrap.
+ */
+static std::string editorCursorMove(int y, int x)
+{
+    char buf[32];
+    std::string best;
+    if (y == 0 && x == 0)
+        best = "\x1b[H";
+    else if (x == 0)
+        best.assign(buf, snprintf(buf, sizeof(buf), "\x1b[%dH", y + 1));
+    else
+        best.assign(buf, snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1));
+    if (screen.cy < 0)
+        return best;
+
+    std::string horizontal = "\r";
+    if (x > 0)
+        editorAppendCsi(horizontal, x, 'C');
+    if (screen.cx >= 0 && x != screen.cx)
+    {
+        std::string rel;
+        editorAppendCsi(rel, std::abs(x - screen.cx), x > screen.cx ? 'C' : 'D');
+        if (rel.size() < horizontal.size())
+            horizontal = rel;
+    }
+    else if (screen.cx >= 0)
+    {
+        horizontal.clear();
+    }
+
+    std::string vertical;
+    int dy = y - screen.cy;
+    if (dy > 0 && dy <= 3)
+        vertical.assign(dy, '\n');
+    else if (dy != 0)
+        editorAppendCsi(vertical, std::abs(dy), dy > 0 ? 'B' : 'A');
+
+    if (horizontal.size() + vertical.size() < best.size())
+        best = horizontal + vertical;
+    return best;
+}
+
+static void editorScreenMoveTo(abuf &ab, int y, int x)
+{
+    if (y == screen.cy && x == screen.cx)
+        return;
+    std::string seq = editorCursorMove(y, x);
+    abAppend(ab, seq.c_str(), (int)seq.size());
+    screen.cy = y;
+    screen.cx = x;
+}
+
+static bool editorScreenRowsEqual(int y_now, int y_shown, int cols)
+{
+    return std::equal(editorScreenRow(screen.cells, y_now), editorScreenRow(screen.cells, y_now) + cols,
+                      editorScreenRow(screen.shown, y_shown));
+}
+
+/**
+ * If the text area moved by a few rows since the last frame, scroll what
+ * the terminal shows with a scroll region (SU/SD) instead of redrawing
+ * the rows that are still there. Only done when it saves rows.
+ */
+static void editorScreenScroll(abuf &ab, int textrows, int textcols)
+{
+    int d = E.rowoff - screen.rowoff;
+    screen.rowoff = E.rowoff;
+    if (d == 0 || std::abs(d) >= textrows)
+        return;
+
+    int same = 0, shifted = 0;
+    for (int y = 0; y < textrows; y++)
+    {
+        same += editorScreenRowsEqual(y, y, textcols);
+        if (y + d >= 0 && y + d < textrows)
+            shifted += editorScreenRowsEqual(y, y + d, textcols);
+    }
+    if (shifted <= same + 1)
+        return;
+
+    std::string seq;
+    char buf[16];
+    seq.append(buf, snprintf(buf, sizeof(buf), "\x1b[1;%dr", textrows));
+    editorAppendCsi(seq, std::abs(d), d > 0 ? 'S' : 'T');
+    seq += "\x1b[r";
+    abAppend(ab, seq.c_str(), (int)seq.size());
+    screen.cy = screen.cx = -1; // DECSTBM homes the cursor
+
+    // Shift 'shown' to match; the rows scrolled in are unknown
+    editorCell *text = editorScreenRow(screen.shown, 0);
+    size_t width = (size_t)screen.cols;
+    if (d > 0)
+    {
+        std::move(text + d * width, text + textrows * width, text);
+        std::fill(text + (textrows - d) * width, text + textrows * width, editorCell());
+    }
+    else
+    {
+        std::move_backward(text, text + (textrows + d) * width, text + textrows * width);
+        std::fill(text, text + (-d) * width, editorCell());
+    }
+}
+
+/**
+ * Send cells [x, end) of row 'y' from the cursor position, which the
+ * caller has set. When the columns are 'exact', runs of one character
+ * use REP, and long blank runs use ECH, where the terminal has them and
+ * they are shorter.
+ */
+static void editorScreenWriteRun(abuf &ab, editorPen &pen, const editorCell *now, int y, int x, int end, bool exact)
+{
+    const editorFace *faces = theme.faces.data();
+    while (x < end)
+    {
+        const editorCell &c = now[x];
+        int run = 1;
+        while (x + run < end && now[x + run] == c)
+            run++;
+
+        if (exact && termcaps.ech && run > 8 && editorCellErasable(c))
+        {
+            std::string seq;
+            editorAppendCsi(seq, run, 'X');
+            editorPenFace(ab, pen, HL_NORMAL);
+            abAppend(ab, seq.c_str(), (int)seq.size());
+            x += run;
+            if (x < end)
+                editorScreenMoveTo(ab, y, x);
+            continue;
+        }
+
+        editorPenSet(ab, pen, faces[c.fg], faces[c.bg], c.attrs);
+        std::string rep;
+        if (exact && termcaps.rep && run > 1)
+            editorAppendCsi(rep, run - 1, 'b');
+        if (!rep.empty() && (int)rep.size() < run - 1)
+        {
+            abAppend(ab, &c.ch, 1);
+            abAppend(ab, rep.c_str(), (int)rep.size());
+        }
+        else
+        {
+            for (int i = 0; i < run; i++)
+                abAppend(ab, &c.ch, 1);
+        }
+        x += run;
+        // At the last column the cursor waits to wrap; don't trust it
+        screen.cx = exact && x < screen.cols ? x : -1;
+    }
+}
+
+/**
+ * Redraw a row holding bytes outside ASCII. Those may not take one
+ * column each, so the text before 'split' goes out in one stream from
+ * the left edge, as the rows always have, and what follows it (the
+ * overview ruler) is placed absolutely.
+ */
+static void editorScreenRewriteRow(abuf &ab, editorPen &pen, int y, int split)
+{
+    const editorCell *now = editorScreenRow(screen.cells, y);
+    int end = split;
+    while (end > 0 && editorCellErasable(now[end - 1]))
+        end--;
+    editorScreenMoveTo(ab, y, 0);
+    editorScreenWriteRun(ab, pen, now, y, 0, end, false);
+    editorPenFace(ab, pen, HL_NORMAL);
+    abAppend(ab, "\x1b[K", 3);
+    screen.cx = -1;
+    if (split < screen.cols)
+    {
+        editorScreenMoveTo(ab, y, split);
+        editorScreenWriteRun(ab, pen, now, y, split, screen.cols, true);
+    }
+}
+
+/**
+ * Bring row 'y' of the terminal up to date: skip the unchanged cells at
+ * either end, jump over unchanged gaps when moving is cheaper than
+ * rewriting them, and clear a blank tail with EL.
+ */
+static void editorScreenFlushRow(abuf &ab, editorPen &pen, int y, int split)
+{
+    const editorCell *now = editorScreenRow(screen.cells, y);
+    const editorCell *was = editorScreenRow(screen.shown, y);
+    int cols = screen.cols;
+
+    int x0 = 0;
+    while (x0 < cols && now[x0] == was[x0])
+        x0++;
+    if (x0 == cols)
+        return;
+
+    for (int x = 0; x < cols; x++)
+    {
+        if ((unsigned char)now[x].ch >= 0x80 || (unsigned char)was[x].ch >= 0x80)
+        {
+            editorScreenRewriteRow(ab, pen, y, split);
+            return;
+        }
+    }
+
+    int x1 = cols;
+    while (x1 > x0 && now[x1 - 1] == was[x1 - 1])
+        x1--;
+    int tail = cols;
+    while (tail > 0 && editorCellErasable(now[tail - 1]))
+        tail--;
+    int end = x1;
+    bool erase = x1 > tail && x1 - std::max(tail, x0) > 3;
+    if (erase)
+        end = std::max(tail, x0);
+
+    int x = x0;
+    while (x < end)
+    {
+        int gap = x;
+        while (gap < end && now[gap] == was[gap])
+            gap++;
+        if (gap == end)
+            break;
+        // Rewriting an unchanged cell costs about a byte
+        if (gap - x >= (int)editorCursorMove(y, gap).size())
+            x = gap;
+        int stop = gap + 1;
+        while (stop < end && now[stop] != was[stop])
+            stop++;
+        editorScreenMoveTo(ab, y, x);
+        editorScreenWriteRun(ab, pen, now, y, x, stop, true);
+        x = stop;
+    }
+    if (erase)
+    {
+        editorScreenMoveTo(ab, y, end);
+        editorPenFace(ab, pen, HL_NORMAL);
+        abAppend(ab, "\x1b[K", 3);
+    }
+}
+
+/**
+ * Send the frame in 'screen.cells' and remember it as shown.
+ */
+static void editorScreenFlush(abuf &ab, int textrows, int textcols)
+{
+    editorScreenScroll(ab, textrows, textcols);
+    editorPen pen; // The last frame ended with the pen reset
+    for (int y = 0; y < screen.rows; y++)
+        editorScreenFlushRow(ab, pen, y, y < textrows ? textcols : screen.cols);
+    editorPenSet(ab, pen, editorFace(), editorFace(), 0);
+    screen.shown = screen.cells;
+}
+
+/*** output ***/
+
+/**
+ * Columns available for text, after the overview ruler if it is shown.
+ */
+static int editorTextCols()
+{
+    if (!E.show_minimap)
+        return E.screencols;
+    return std::max(E.screencols - BOLT_MINIMAP_WIDTH, 1);
+}
+
+/**
+ * Update E.rowoff and E.coloff so that E.cx and E.cy are within
+ * the visible window on screen.
+ */
+static void editorScroll()
+{
+    // Apply all wheel movement since the last frame in one step
+    if (E.scroll_pending)
+    {
+        E.rowoff += E.scroll_pending;
+        E.scroll_pending = 0;
+        editorEnsureRows((size_t)(E.rowoff + E.screenrows));
+        if (E.rowoff > (int)E.rows.size() - 1)
+            E.rowoff = (int)E.rows.size() - 1;
+        if (E.rowoff < 0)
+            E.rowoff = 0;
+
+        // Drag the cursor along so the follow logic below keeps this offset
+        if (E.cy < E.rowoff)
+            E.cy = E.rowoff;
+        if (E.cy >= E.rowoff + E.screenrows)
+            E.cy = E.rowoff + E.screenrows - 1;
+        if (E.cy < (int)E.rows.size() && E.cx > (int)E.rows[E.cy].chars.size())
+            E.cx = (int)E.rows[E.cy].chars.size();
+    }
+
+    E.rx = 0;
+    if (E.cy < (int)E.rows.size())
+    {
+        E.rx = editorRowCxToRx(E.rows[E.cy], E.cx);
+    }
+
+    // Vertical scrolling
+    if (E.cy < E.rowoff)
+    {
+        E.rowoff = E.cy;
+    }
+    if (E.cy >= E.rowoff + E.screenrows)
+    {
+        E.rowoff = E.cy - E.screenrows + 1;
+    }
+
+    // Horizontal scrolling
+    if (E.rx < E.coloff)
+    {
+        E.coloff = E.rx;
+    }
+    if (E.rx >= E.coloff + editorTextCols())
+    {
+        E.coloff = E.rx - editorTextCols() + 1;
+    }
+}
+
+/**
+ * Get the selected span of 'filerow' as render columns [start, end).
+ * Returns false if nothing on the row is selected.
+ */
+static bool editorSelectionOnRow(int filerow, int &start, int &end)
+{
+    if (!E.sel_active)
+        return false;
+
+    int ay = E.sel_cy, ax = E.sel_cx, by = E.cy, bx = E.cx;
+    if (ay > by || (ay == by && ax > bx))
+    {
+        std::swap(ay, by);
+        std::swap(ax, bx);
+    }
+    if (filerow < ay || filerow > by || filerow >= (int)E.rows.size())
+        return false;
+
+    const ERow &row = E.rows[filerow];
+    start = filerow == ay ? editorRowCxToRx(row, ax) : 0;
+    end = filerow == by ? editorRowCxToRx(row, bx) : row.width;
+    return start < end;
+}
+
+/*** overlays ***/
+
+/*
+ * Transient decorations (the selection, search matches, bracket pairs,
+ * diagnostics) are spans of render columns drawn in a theme face over
+ * the syntax colours, without touching ERow::hl. Where spans overlap
+ * their attributes combine, and the colours of the highest priority
+ * span that sets them win.
+ */
+#define OV_PRIO_SELECTION 10
+#define OV_PRIO_DIAGNOSTIC 20
+#define OV_PRIO_BRACKET 30
+#define OV_PRIO_MATCH 40
+#define OV_PRIO_CURRENT_MATCH 50
+
+struct editorOverlay
+{
+    int row;
+    int start, end; // Render columns [start, end)
+    int priority;
+    int face;       // FACE_* id
+};
+
+static void editorOverlaySelection(int first, int last, std::vector<editorOverlay> &out)
+{
+    for (int y = first; y < last && E.sel_active; y++)
+    {
+        int start, end;
+        if (editorSelectionOnRow(y, start, end))
+            out.push_back({y, start, end, OV_PRIO_SELECTION, FACE_SELECTION});
+    }
+}
+
+/**
+ * Every match of the search in progress on rows [first, last); the
+ * one the cursor is on is also inverted.
+ */
+static void editorOverlaySearch(int first, int last, std::vector<editorOverlay> &out)
+{
+    const std::string &query = E.find_query;
+    if (query.empty())
+        return;
+    for (int y = first; y < last; y++)
+    {
+        const ERow &row = E.rows[y];
+        for (size_t pos = row.chars.find(query); pos != std::string::npos; pos = row.chars.find(query, pos + 1))
+        {
+            int start = editorRowCxToRx(row, (int)pos);
+            int end = editorRowCxToRx(row, (int)(pos + query.size()));
+            bool current = y == E.find_row && (int)pos == E.find_col;
+            out.push_back({y, start, end, current ? OV_PRIO_CURRENT_MATCH : OV_PRIO_MATCH,
+                           current ? (int)FACE_CURRENT_MATCH : (int)HL_MATCH});
+        }
+    }
+}
+
+/**
+ * The bracket at (or just before) the cursor and its partner, if the
+ * partner is on rows [first, last). Brackets in strings and comments
+ * don't count.
+ */
+static void editorOverlayBrackets(int first, int last, std::vector<editorOverlay> &out)
+{
+    static const char pairs[] = "()[]{}";
+    if (E.cy < first || E.cy >= last)
+        return;
+    const ERow &row = editorRowCached(E.cy);
+
+    int at = -1;
+    for (int x = E.rx; x >= E.rx - 1 && x >= 0 && at < 0; x--)
+    {
+        if (x < (int)row.render.size() && row.render[x] && strchr(pairs, row.render[x]) &&
+            row.hl[x] != HL_STRING && row.hl[x] != HL_COMMENT)
+            at = x;
+    }
+    if (at < 0)
+        return;
+
+    const char *p = strchr(pairs, row.render[at]);
+    bool opens = (p - pairs) % 2 == 0;
+    char self = *p, other = opens ? p[1] : p[-1];
+    int dir = opens ? 1 : -1;
+    int depth = 0;
+    for (int y = E.cy; y >= first && y < last; y += dir)
+    {
+        const ERow &r = editorRowCached(y);
+        int x = y == E.cy ? at : (dir > 0 ? 0 : (int)r.render.size() - 1);
+        for (; x >= 0 && x < (int)r.render.size(); x += dir)
+        {
+            if (r.hl[x] == HL_STRING || r.hl[x] == HL_COMMENT)
+                continue;
+            if (r.render[x] == self)
+            {
+                depth++;
+            }
+            else if (r.render[x] == other && --depth == 0)
+            {
+                out.push_back({E.cy, at, at + 1, OV_PRIO_BRACKET, FACE_BRACKET});
+                out.push_back({y, x, x + 1, OV_PRIO_BRACKET, FACE_BRACKET});
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Underline the token at each parsed location anchored on rows
+ * [first, last), or the whole line when there is no column.
+ */
+static void editorOverlayDiagnostics(int first, int last, std::vector<editorOverlay> &out)
+{
+    editorAnchors &a = E.diagnostics;
+    if (a.count == 0)
+        return;
+    std::vector<int> ids;
+    editorAnchorRows(a, a.root, first, last, ids);
+    for (int id : ids)
+    {
+        int y = a.nodes[id].row;
+        bool whole_line = E.diagnostic_line[id];
+        const ERow &row = editorRowCached(y);
+        int start = row.indent_width;
+        if (!whole_line)
+            start = editorRowCxToRx(row, std::min(a.nodes[id].col, (int)row.chars.size()));
+        int end = start;
+        while (end < (int)row.render.size() && !is_separator(row.render[end]))
+            end++;
+        if (end == start)
+            end = whole_line ? (int)row.render.size() : start + 1;
+        out.push_back({y, start, end, OV_PRIO_DIAGNOSTIC, FACE_DIAGNOSTIC});
+    }
+}
+
+/**
+ * Gather the overlays for rows [first, last), ordered by row and start.
+ */
+static void editorCollectOverlays(int first, int last, std::vector<editorOverlay> &out)
+{
+    out.clear();
+    editorOverlaySelection(first, last, out);
+    editorOverlaySearch(first, last, out);
+    editorOverlayBrackets(first, last, out);
+    editorOverlayDiagnostics(first, last, out);
+    std::sort(out.begin(), out.end(), [](const editorOverlay &a, const editorOverlay &b) {
+        return a.row != b.row ? a.row < b.row : a.start < b.start;
+    });
+}
+
+/**
+ * Draw the visible part of 'row', merging its syntax faces with the
+ * overlays in [ov, ov_end) (sorted by start) in one pass: the set of
+ * active overlays only changes at their start and end columns.
+ */
+static void editorDrawRowText(int y, const ERow &row, int len, const editorOverlay *ov, const editorOverlay *ov_end)
+{
+    std::vector<const editorOverlay *> active;
+    int boundary = E.coloff; // Next column where the active set may change
+    int ov_fg = -1, ov_bg = -1;
+    int ov_attrs = 0;
+
+    for (int j = 0; j < len; j++)
+    {
+        int col = E.coloff + j;
+        if (col >= boundary)
+        {
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [col](const editorOverlay *o) { return o->end <= col; }),
+                         active.end());
+            for (; ov < ov_end && ov->start <= col; ov++)
+            {
+                if (ov->end > col)
+                    active.push_back(ov);
+            }
+
+            boundary = ov < ov_end ? ov->start : INT_MAX;
+            ov_fg = ov_bg = -1;
+            ov_attrs = 0;
+            int fg_priority = -1, bg_priority = -1;
+            for (const editorOverlay *o : active)
+            {
+                const editorFace &f = theme.faces[o->face];
+                boundary = std::min(boundary, o->end);
+                ov_attrs |= f.attrs;
+                if (f.fg != COLOR_DEFAULT && o->priority > fg_priority)
+                {
+                    ov_fg = o->face;
+                    fg_priority = o->priority;
+                }
+                if (f.bg != COLOR_DEFAULT && o->priority > bg_priority)
+                {
+                    ov_bg = o->face;
+                    bg_priority = o->priority;
+                }
+            }
+        }
+
+        int base = row.hl[col];
+        editorScreenPut(y, j, row.render[col], ov_fg >= 0 ? ov_fg : base, ov_bg >= 0 ? ov_bg : base,
+                        theme.faces[base].attrs | ov_attrs);
+    }
+}
+
+/**
+ * The rows [first, last) that line 'y' of the overview ruler stands for.
+ * Short files get one row per line; longer ones are spread evenly.
+ */
+static void editorMinimapSpan(int y, int &first, int &last)
+{
+    long long n = (long long)E.rows.size();
+    if (n <= E.screenrows)
+    {
+        first = (int)std::min((long long)y, n);
+        last = (int)std::min((long long)y + 1, n);
+        return;
+    }
+    first = (int)(y * n / E.screenrows);
+    last = (int)((y + 1) * n / E.screenrows);
+}
+
+/**
+ * Draw one line of the overview ruler from the shade totals of the rows
+ * it covers: a marker for search matches, bookmarks or unsaved changes,
+ * then a glyph whose density follows the amount of text, coloured by
+ * the dominant highlight class. Lines covering the viewport are inverted.
+ */
+static void editorDrawMinimapLine(int y, int x, int first, int last, const editorShadeCounts &sum)
+{
+    int rows = last - first;
+    bool in_view = rows > 0 && first < E.rowoff + E.screenrows && last > E.rowoff;
+    int extra = in_view ? ATTR_REVERSE : 0;
+
+    auto match = std::lower_bound(E.match_rows.begin(), E.match_rows.end(), first);
+    int marker_face = HL_NORMAL;
+    char marker = ' ';
+    if (match != E.match_rows.end() && *match < last)
+    {
+        marker_face = HL_MATCH;
+        marker = '*';
+    }
+    else if (editorAnchorInRows(E.bookmarks, first, last))
+    {
+        marker_face = FACE_BOOKMARK;
+        marker = '#';
+    }
+    else if (sum[SHADE_MODIFIED] > 0)
+    {
+        marker_face = FACE_MODIFIED;
+        marker = '|';
+    }
+    editorScreenPut(y, x, marker, marker_face, marker_face, theme.faces[marker_face].attrs | extra);
+
+    static const char ramp[] = " .:=#";
+    long long avg = rows > 0 ? sum[SHADE_TEXT] / rows : 0;
+    int level = avg == 0 ? 0 : (int)std::min(1 + avg / 16, (long long)sizeof(ramp) - 2);
+
+    static const int hl_of[] = {HL_NORMAL, HL_COMMENT, HL_KEYWORD1, HL_STRING, HL_NUMBER};
+    int best = SHADE_COMMENT;
+    for (int k = SHADE_KEYWORD; k <= SHADE_NUMBER; k++)
+    {
+        if (sum[k] > sum[best])
+            best = k;
+    }
+    if (sum[best] == 0 || sum[best] * 4 < sum[SHADE_TEXT])
+        best = SHADE_TEXT; // Mostly plain text
+
+    int face = hl_of[best];
+    editorScreenPut(y, x + 1, ramp[level], face, face, theme.faces[face].attrs | extra);
+}
+
+/**
+ * Draw the rows of text (or '~' / welcome message) for each row on screen,
+ * and the overview ruler beside them when it is switched on. The ruler
+ * takes O(log n + BOLT_INDEX_BLOCK) per screen line from the row index,
+ * however long the file is.
+ */
+static void editorDrawRows()
+{
+    int textcols = editorTextCols();
+    std::vector<editorOverlay> overlays;
+    editorCollectOverlays(E.rowoff, std::min(E.rowoff + E.screenrows, (int)E.rows.size()), overlays);
+    size_t ov = 0;
+    // Shades of rows [0, ruler_row), carried down the ruler since each
+    // line usually starts where the one above it ended
+    editorShadeCounts above{};
+    int ruler_row = -1;
+
+    for (int y = 0; y < E.screenrows; y++)
+    {
+        int filerow = y + E.rowoff;
+        if (filerow >= (int)E.rows.size())
+        {
+            // Display welcome message or '~'
+            editorScreenText(y, 0, "~", 1, HL_NORMAL);
+            if (E.rows.empty() && y == E.screenrows / 3)
+            {
+                std::ostringstream ss;
+                ss << "Kilo editor -- version " << KILO_VERSION;
+                std::string welcome = ss.str();
+                if ((int)welcome.size() > textcols)
+                {
+                    welcome.resize(textcols);
+                }
+                int padding = (textcols - (int)welcome.size()) / 2;
+                editorScreenText(y, padding, welcome.c_str(), (int)welcome.size(), HL_NORMAL);
+            }
+        }
+        else
+        {
+            const ERow &row = editorRowCached(filerow);
+            int len = row.width - E.coloff;
+            if (len < 0)
+                len = 0;
+            if (len > textcols)
+                len = textcols;
+
+            while (ov < overlays.size() && overlays[ov].row < filerow)
+                ov++;
+            size_t ov_end = ov;
+            while (ov_end < overlays.size() && overlays[ov_end].row == filerow)
+                ov_end++;
+            editorDrawRowText(y, row, len, overlays.data() + ov, overlays.data() + ov_end);
+            ov = ov_end;
+        }
+
+        if (E.show_minimap)
+        {
+            int first, last;
+            editorShadeCounts below, sum;
+            editorMinimapSpan(y, first, last);
+            if (ruler_row != first)
+                editorShadePrefix(first, above);
+            editorShadePrefix(last, below);
+            for (int k = 0; k < SHADE_COUNT; k++)
+                sum[k] = below[k] - above[k];
+            above = below;
+            ruler_row = last;
+            editorDrawMinimapLine(y, textcols, first, last, sum);
+        }
+    }
+}
+
+/**
+ * Draw the status bar (filename, dirty status, line count, etc.).
+ */
+static void editorDrawStatusBar(int y)
+{
+    // Left status
+    std::ostringstream leftStatus;
+    leftStatus << (E.filename.empty() ? "[No Name]" : E.filename)
+               << " - " << E.rows.size() << (E.loader.active ? "+" : "") << " lines"
+               << (E.dirty ? " (modified)" : "");
+    if (E.encoding != ENC_UTF8 || E.bom)
+        leftStatus << " [" << editorEncodingName(E.encoding) << (E.bom ? " bom" : "") << "]";
+    if (!E.buffers.empty())
+        leftStatus << " [+" << E.buffers.size() << " buffers]";
+
+    // Right status: filetype, byte offset and line
+    long long offset = editorPosToOffset(std::min(E.cy, (int)E.rows.size()), E.cy < (int)E.rows.size() ? E.cx : 0);
+    long long total = editorRowOffset((int)E.rows.size());
+    std::ostringstream rightStatus;
+    rightStatus << (E.syntax ? E.syntax->filetype : "no ft")
+                << " | byte " << offset << " (" << (total ? offset * 100 / total : 100) << "%)"
+                << " | " << (E.cy + 1) << "/" << E.rows.size();
+
+    std::string lStr = leftStatus.str();
+
+    std::string rStr = rightStatus.str(); // Convert right status to a string
+
+    for (int x = 0; x < E.screencols; x++)
+        editorScreenPut(y, x, ' ', FACE_STATUS, FACE_STATUS, theme.faces[FACE_STATUS].attrs);
+    int len = std::min((int)lStr.size(), E.screencols);
+    editorScreenText(y, 0, lStr.c_str(), len, FACE_STATUS);
+
+    // Place the right status against the right edge if it fits
+    int rlen = (int)rStr.size();
+    if (len + rlen <= E.screencols)
+        editorScreenText(y, E.screencols - rlen, rStr.c_str(), rlen, FACE_STATUS);
+}
+
+/*** memory accounting ***/
+
+/*
+ * What the editor's containers hold on the heap, from their capacities.
+ * Walking every row makes this O(rows), so it is only done on request.
+ * Allocator overhead isn't counted.
+ */
+
+static void editorMemAccountAnchors(const editorAnchors &a, BoltMemory &m)
+{
+    m.index += (long long)(a.nodes.capacity() * sizeof(editorAnchor) + a.free_ids.capacity() * sizeof(int));
+}
+
+static void editorMemAccountBuffer(const editorBuffer &b, BoltMemory &m)
+{
+    for (const ERow &row : b.rows)
+    {
+        m.text += editorHeapBytes(row.chars);
+        m.render += editorHeapBytes(row.render) + (long long)(row.rx2cx.capacity() * sizeof(int));
+        m.hl += (long long)(row.hl.capacity() * sizeof(int));
+    }
+    m.rows += (long long)(b.rows.capacity() * sizeof(ERow));
+    m.lines += (long long)b.rows.size();
+
+    for (const editorUndoGroup &g : b.undo)
+    {
+        for (const std::string &line : g.before)
+            m.undo += editorHeapBytes(line);
+        m.undo += (long long)(g.before.capacity() * sizeof(std::string));
+    }
+    m.undo += (long long)(b.undo.capacity() * sizeof(editorUndoGroup));
+
+    // A map node carries its value and three pointers and a colour
+    const long long map_node = 4 * (long long)sizeof(void *);
+    const editorRowIndex &ix = b.index;
+    size_t index = ix.rows.capacity() + ix.bytes.capacity() + ix.rows_tree.tree.capacity() + ix.bytes_tree.tree.capacity();
+    for (int k = 0; k < SHADE_COUNT; k++)
+        index += ix.shades[k].capacity() + ix.shade_trees[k].tree.capacity();
+    m.index += (long long)(index * sizeof(long long));
+    m.index += (long long)(b.match_rows.capacity() * sizeof(int));
+    m.index += (long long)b.stats.widths.size() * (map_node + (long long)sizeof(std::pair<const int, int>));
+    m.index += (long long)b.mark_ids.size() * (map_node + (long long)sizeof(std::pair<const char, int>));
+    editorMemAccountAnchors(b.bookmarks, m);
+    editorMemAccountAnchors(b.marks, m);
+    editorMemAccountAnchors(b.diagnostics, m);
+    m.index += (long long)(b.diagnostic_ids.capacity() * sizeof(int) + b.diagnostic_line.capacity() / 8);
+
+    m.index += (long long)(b.cache.ring.size() * sizeof(int));
+    m.cache += editorHeapBytes(b.loader.pending) + editorHeapBytes(b.loader.carry);
+}
+
+static BoltMemory editorMemUsage()
+{
+    BoltMemory m = {};
+    editorMemAccountBuffer(E, m);
+    for (const editorBuffer &b : E.buffers)
+        editorMemAccountBuffer(b, m);
+    m.rows += (long long)(E.buffers.capacity() * sizeof(editorBuffer));
+
+    for (const editorLocation &loc : E.errors)
+        m.index += editorHeapBytes(loc.file) + editorHeapBytes(loc.path);
+    m.index += (long long)(E.errors.capacity() * sizeof(editorLocation));
+
+    m.cache += (long long)((screen.cells.capacity() + screen.shown.capacity()) * sizeof(editorCell));
+    m.cache += editorHeapBytes(screen.frame);
+    return m;
+}
+
+/**
+ * Format a byte count the way the memory line shows it: "812", "4.0K",
+ * "12.3M", "1.5G".
+ */
+static std::string editorFormatBytes(long long n)
+{
+    static const char units[] = "KMGT";
+    if (n < 1024)
+        return std::to_string(n);
+    double v = (double)n;
+    int u = -1;
+    while (v >= 1024 && u < 3)
+    {
+        v /= 1024;
+        u++;
+    }
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%.1f%c", v, units[u]);
+    return buf;
+}
+
+/**
+ * One line for the message bar: the heap bytes per subsystem, the total
+ * and what each row costs on top of its text.
+ */
+static std::string editorMemLine()
+{
+    BoltMemory m = editorMemUsage();
+    long long total = m.text + m.render + m.hl + m.rows + m.undo + m.index + m.cache;
+    std::ostringstream ss;
+    ss << "text " << editorFormatBytes(m.text) << " | render " << editorFormatBytes(m.render)
+       << " | hl " << editorFormatBytes(m.hl) << " | rows " << editorFormatBytes(m.rows)
+       << " | undo " << editorFormatBytes(m.undo) << " | index " << editorFormatBytes(m.index)
+       << " | cache " << editorFormatBytes(m.cache) << " | total " << editorFormatBytes(total);
+    if (m.lines > 0)
+        ss << " | " << (total - m.text) / m.lines << " B/row over text";
+    return ss.str();
+}
+
+/**
+ * The statistics panel, built from the running totals in E.stats.
+ */
+static std::string editorStatsLine()
+{
+    std::ostringstream ss;
+    ss << E.stats.bytes + (long long)E.rows.size() << " bytes | "
+       << E.rows.size() << (E.loader.active ? "+" : "") << " lines | "
+       << E.stats.words << " words | "
+       << E.stats.chars << " chars | longest "
+       << (E.stats.widths.empty() ? 0 : E.stats.widths.rbegin()->first);
+    return ss.str();
+}
+
+/**
+ * Draw the message bar at the bottom: a fresh status message if there
+ * is one, otherwise the statistics panel when it is switched on.
+ */
+static void editorDrawMessageBar(int y)
+{
+    bool fresh = !E.statusmsg.empty() && time(nullptr) - E.statusmsg_time < 5;
+    std::string msg = fresh ? E.statusmsg : E.show_stats ? editorStatsLine() : "";
+    int msglen = std::min((int)msg.size(), E.screencols);
+    editorScreenText(y, 0, msg.c_str(), msglen, HL_NORMAL);
+}
+
+/**
+ * Refresh the screen: draw the frame into the cell grid, then send the
+ * terminal only what changed since the last one, with the cursor hidden
+ * and, where supported, inside a synchronized update.
+ */
+static void editorRefreshScreen()
+{
+    editorScroll();
+
+    abuf ab;
+    abAppend(ab, "\x1b[?25l");
+    if (termcaps.sync)
+        abAppend(ab, "\x1b[?2026h");
+
+    // Draw text and bars
+    editorScreenBegin(E.screenrows + 2, E.screencols);
+    editorDrawRows();
+    editorDrawStatusBar(E.screenrows);
+    editorDrawMessageBar(E.screenrows + 1);
+    editorScreenFlush(ab, E.screenrows, editorTextCols());
+
+    editorScreenMoveTo(ab, E.cy - E.rowoff, E.rx - E.coloff);
+    if (termcaps.sync)
+        abAppend(ab, "\x1b[?2026l");
+    abAppend(ab, "\x1b[?25h");
+    editorCacheTrim();
+    boltProfilePhase("draw frame");
+
+    screen.frame.assign(ab.b.data(), ab.b.size());
+    if (term)
+        term->write(screen.frame.data(), screen.frame.size());
+    if (profile_out)
+    {
+        boltProfilePhase("write frame");
+        fflush(profile_out);
+        profile_out = nullptr;
+    }
+}
+
+/**
+ * Set a timed status message (fades out after a few seconds).
+ */
+static void editorSetStatusMessage(const char *fmt, ...)
+{
+    char buf[80];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    E.statusmsg = buf;
+    E.statusmsg_time = time(nullptr);
+}
+
+/*** input ***/
+
+/**
+ * Prompt the user for input in the status bar. The prompt must contain
+ * a "%s" where we insert the user's input. Returns the input string,
+ * or empty if the user cancels with ESC.
+ */
+static std::string editorPrompt(const std::string &prompt, void (*callback)(std::string &, int))
+{
+    std::string reply;
+    while (true)
+    {
+        // Build the status message: prompt + current input
+        char status[256];
+        snprintf(status, sizeof(status), prompt.c_str(), reply.c_str());
+        editorSetStatusMessage("%s", status);
+        editorRefreshScreen();
+
+        int c = editorReadKey();
+        if (c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+        {
+            if (!reply.empty())
+            {
+                reply.pop_back();
+            }
+        }
+        else if (c == '\x1b')
+        {
+            editorSetStatusMessage("");
+            if (callback) callback(reply, c);
+            return std::string();
+        }
+        else if (c == '\r')
+        {
+            if (!reply.empty())
+            {
+                editorSetStatusMessage("");
+                if (callback) callback(reply, c);
+                return reply;
+            }
+        }
+        else if (!iscntrl(c) && c < 128)
+        {
+            reply.push_back((char)c);
+        }
+
+        if (callback) callback(reply, c);
+    }
+}
+
+/**
+ * Move the cursor in response to arrow keys, page keys, etc.
+ */
+static void editorMoveCursor(int key)
+{
+    if (E.rows.empty())
+    {
+        // No lines, nothing to move over
+        return;
+    }
+    switch (key)
+    {
+    case ARROW_LEFT:
+        if (E.cx > 0)
+        {
+            E.cx--;
+        }
+        else if (E.cy > 0)
+        {
+            E.cy--;
+            E.cx = (int)E.rows[E.cy].chars.size();
+        }
+        break;
+    case ARROW_RIGHT:
+    {
+        int rowLen = E.cy < (int)E.rows.size() ? (int)E.rows[E.cy].chars.size() : 0;
+        if (E.cx < rowLen)
+        {
+            E.cx++;
+        }
+        else if (E.cy < (int)E.rows.size() - 1)
+        {
+            E.cy++;
+            E.cx = 0;
+        }
+    }
+    break;
+    case ARROW_UP:
+        if (E.cy > 0)
+        {
+            E.cy--;
+        }
+        break;
+    case ARROW_DOWN:
+        editorEnsureRows((size_t)E.cy + 2);
+        if (E.cy < (int)E.rows.size() - 1)
+        {
+            E.cy++;
+        }
+        break;
+    default:
+        break;
+    }
+    // Clamp cursor x to the length of the current row; the virtual row
+    // past the end is empty
+    int rowlen = E.cy < (int)E.rows.size() ? (int)E.rows[E.cy].chars.size() : 0;
+    if (E.cx > rowlen)
+    {
+        E.cx = rowlen;
+    }
+}
+
+/*** keymap ***/
+
+/*
+ * The keymap is compiled into a trie of flat dispatch tables, one per
+ * key-sequence prefix, each indexed directly by key code. An entry is
+ * KEYMAP_UNBOUND, a command index (> 0), or a child node (-node).
+ */
+#define KEYMAP_UNBOUND 0
+
+struct editorKeymap
+{
+    std::vector<std::array<int, KEY_COUNT>> nodes;
+    int state = 0; // Current node while a multi-key sequence is pending
+};
+
+static thread_local editorKeymap *bound_keymap;
+static thread_local int *bound_quit_times;
+#define keymap (*bound_keymap)
+#define quit_times (*bound_quit_times)
+
+static void editorCommandNop(int) {}
+
+static void editorCommandInsert(int key)
+{
+    if (key >= 256)
+        return;
+
+    const std::array<char, 128> &pairs = E.syntax ? E.syntax->pair_close : E.default_pair_close;
+    char close = key < 128 ? pairs[key] : '\0';
+
+    if (key == '}')
+        editorOutdentForClose();
+    editorInsertChar((char)key);
+    if (close)
+    {
+        editorInsertChar(close);
+        E.cx--;
+    }
+}
+
+static void editorCommandNewline(int) { editorInsertNewline(); }
+
+static void editorCommandQuit(int)
+{
+    if (editorAnyDirty() && quit_times > 0)
+    {
+        editorSetStatusMessage(
+            "WARNING!!! File has unsaved changes. "
+            "Press Ctrl-Q %d more times to quit.",
+            quit_times);
+        quit_times--;
+        return;
+    }
+    editorSaveSession();
+    if (term)
+    {
+        term->write("\x1b[2J\x1b[H", 7); // Clear screen
+        term->quit();
+    }
+}
+
+static void editorCommandSave(int) { editorSave(); }
+static void editorCommandFind(int) { editorFind(); }
+static void editorCommandOpen(int) { editorOpenPrompt(); }
+static void editorCommandNextBuffer(int) { editorNextBuffer(); }
+static void editorCommandHome(int) { E.cx = 0; }
+
+static void editorCommandEnd(int)
+{
+    if (E.cy < (int)E.rows.size())
+        E.cx = (int)E.rows[E.cy].chars.size();
+}
+
+static void editorCommandBackspace(int) { editorDelChar(); }
+
+static void editorCommandDelete(int)
+{
+    // Delete forward: step over the character, then backspace it.
+    editorMoveCursor(ARROW_RIGHT);
+    editorDelChar();
+}
+
+static void editorCommandPage(int key)
+{
+    if (key == PAGE_UP)
+    {
+        E.cy = E.rowoff;
+    }
+    else
+    {
+        editorEnsureRows((size_t)(E.rowoff + 2 * E.screenrows));
+        E.cy = E.rowoff + E.screenrows - 1;
+        if (E.cy > (int)E.rows.size())
+            E.cy = (int)E.rows.size();
+    }
+    int times = E.screenrows;
+    while (times--)
+    {
+        editorMoveCursor((key == PAGE_UP) ? ARROW_UP : ARROW_DOWN);
+    }
+}
+
+static void editorCommandPageUp(int) { editorCommandPage(PAGE_UP); }
+static void editorCommandPageDown(int) { editorCommandPage(PAGE_DOWN); }
+/**
+ * Handle an SGR mouse report: a left click places the cursor, dragging
+ * selects, and the wheel queues a scroll that is applied once per frame.
+ */
+static void editorCommandMouse(int)
+{
+    const editorInputEvent &m = input.last;
+    int button = m.mouse_button & 3;
+    bool motion = m.mouse_button & 32;
+
+    if (m.mouse_button & 64)
+    {
+        if (m.mouse_press)
+            E.scroll_pending += (button == 0 ? -1 : 1) * BOLT_WHEEL_ROWS;
+        return;
+    }
+    if (button != 0)
+        return;
+    if (!m.mouse_press)
+    {
+        E.mouse_dragging = false;
+        return;
+    }
+    if (motion && !E.mouse_dragging)
+        return;
+    if (!motion && m.mouse_y >= E.screenrows)
+        return; // Click on the status or message bar
+    if (!motion && E.show_minimap && m.mouse_x >= editorTextCols())
+    {
+        // Click on the overview ruler: jump to the rows it stands for
+        int first, last;
+        editorMinimapSpan(m.mouse_y, first, last);
+        E.cy = std::min(first, std::max((int)E.rows.size() - 1, 0));
+        E.cx = 0;
+        E.rowoff = E.cy;
+        E.sel_active = false;
+        return;
+    }
+
+    int cy = E.rowoff + std::max(m.mouse_y, 0);
+    editorEnsureRows((size_t)cy + 1);
+    if (cy >= (int)E.rows.size())
+        cy = std::max((int)E.rows.size() - 1, 0);
+    int cx = cy < (int)E.rows.size() ? editorRowRxToCx(editorRowCached(cy), E.coloff + m.mouse_x) : 0;
+
+    if (!motion)
+    {
+        E.sel_active = false;
+        E.sel_cx = cx;
+        E.sel_cy = cy;
+        E.mouse_dragging = true;
+    }
+    else
+    {
+        E.sel_active = cx != E.sel_cx || cy != E.sel_cy;
+    }
+    E.cx = cx;
+    E.cy = cy;
+}
+
+/**
+ * Shift+arrow: extend the selection, starting one at the cursor if needed.
+ */
+static void editorCommandSelect(int key)
+{
+    if (!E.sel_active)
+    {
+        E.sel_active = true;
+        E.sel_cx = E.cx;
+        E.sel_cy = E.cy;
+    }
+    editorMoveCursor(ARROW_LEFT + (key - SHIFT_ARROW_LEFT));
+}
+
+/**
+ * Tab indents the selected rows when there is a selection, and inserts
+ * a tab otherwise.
+ */
+static void editorCommandTab(int key)
+{
+    if (E.sel_active)
+        editorIndentRegion(1);
+    else
+        editorCommandInsert(key);
+}
+
+static void editorCommandOutdent(int) { editorIndentRegion(-1); }
+static void editorCommandToggleComment(int) { editorToggleCommentRegion(); }
+static void editorCommandUndo(int) { editorUndo(); }
+
+/**
+ * Jump to "line", "line:col" or "#byte-offset".
+ */
+static void editorCommandGoto(int)
+{
+    std::string target = editorPrompt("Goto line[:col] or #offset: %s (ESC to cancel)", NULL);
+    if (target.empty())
+        return;
+
+    if (target[0] == '#')
+    {
+        long long offset = atoll(target.c_str() + 1);
+        while (E.loader.active && editorRowOffset((int)E.rows.size()) <= offset)
+            editorLoadRows(BOLT_LOAD_CHUNK);
+        editorOffsetToPos(offset, E.cy, E.cx);
+        return;
+    }
+
+    int line = 0, col = 1;
+    if (sscanf(target.c_str(), "%d:%d", &line, &col) < 1 || line < 1)
+    {
+        editorSetStatusMessage("Bad location: %s", target.c_str());
+        return;
+    }
+    editorGotoLine(line, col);
+}
+
+static void editorCommandErrors(int) { editorErrorsHere(); }
+static void editorCommandNextError(int) { editorNextError(1); }
+static void editorCommandPrevError(int) { editorNextError(-1); }
+
+static void editorCommandStats(int)
+{
+    E.show_stats = !E.show_stats;
+    E.statusmsg.clear();
+}
+
+static void editorCommandMem(int)
+{
+    // Too long for editorSetStatusMessage()'s buffer
+    E.statusmsg = editorMemLine();
+    E.statusmsg_time = time(nullptr);
+}
+
+static void editorCommandMinimap(int)
+{
+    E.show_minimap = !E.show_minimap;
+    if (!E.show_minimap)
+    {
+        // Built again from the rows' cached counts when next shown
+        editorIndexDropShades();
+    }
+}
+
+static void editorCommandBookmark(int) { editorToggleBookmark(); }
+static void editorCommandNextBookmark(int) { editorNextBookmark(1); }
+static void editorCommandPrevBookmark(int) { editorNextBookmark(-1); }
+static void editorCommandSetMark(int) { editorSetMark(); }
+static void editorCommandJumpMark(int) { editorJumpToMark(); }
+
+static void editorCommandUp(int) { editorMoveCursor(ARROW_UP); }
+static void editorCommandDown(int) { editorMoveCursor(ARROW_DOWN); }
+static void editorCommandLeft(int) { editorMoveCursor(ARROW_LEFT); }
+static void editorCommandRight(int) { editorMoveCursor(ARROW_RIGHT); }
+
+struct editorCommand
+{
+    const char *name;
+    void (*fn)(int key);          // Receives the key that triggered the command
+    bool keeps_selection = false; // Otherwise the selection is dropped afterwards
+};
+
+// Index 0 is reserved so that KEYMAP_UNBOUND never names a command.
+static const editorCommand editorCommands[] = {
+    {"nop", editorCommandNop, true},
+    {"self-insert", editorCommandInsert},
+    {"newline", editorCommandNewline},
+    {"quit", editorCommandQuit},
+    {"save", editorCommandSave},
+    {"find", editorCommandFind},
+    {"open", editorCommandOpen},
+    {"next-buffer", editorCommandNextBuffer},
+    {"home", editorCommandHome},
+    {"end", editorCommandEnd},
+    {"backspace", editorCommandBackspace},
+    {"delete", editorCommandDelete},
+    {"page-up", editorCommandPageUp},
+    {"page-down", editorCommandPageDown},
+    {"up", editorCommandUp},
+    {"down", editorCommandDown},
+    {"left", editorCommandLeft},
+    {"right", editorCommandRight},
+    {"mouse", editorCommandMouse, true},
+    {"select", editorCommandSelect, true},
+    {"tab", editorCommandTab, true},
+    {"outdent", editorCommandOutdent, true},
+    {"toggle-comment", editorCommandToggleComment, true},
+    {"undo", editorCommandUndo},
+    {"stats", editorCommandStats, true},
+    {"goto", editorCommandGoto},
+    {"errors", editorCommandErrors},
+    {"next-error", editorCommandNextError},
+    {"prev-error", editorCommandPrevError},
+    {"minimap", editorCommandMinimap, true},
+    {"bookmark", editorCommandBookmark},
+    {"next-bookmark", editorCommandNextBookmark},
+    {"prev-bookmark", editorCommandPrevBookmark},
+    {"set-mark", editorCommandSetMark},
+    {"jump-mark", editorCommandJumpMark},
+    {"mem", editorCommandMem, true},
+};
+
+#define CMD_SELF_INSERT 1
+#define CMD_QUIT 3
+
+static const char *editorDefaultKeymap =
+    "bind enter newline\n"
+    "bind ctrl-q quit\n"
+    "bind ctrl-s save\n"
+    "bind ctrl-f find\n"
+    "bind ctrl-o open\n"
+    "bind ctrl-n next-buffer\n"
+    "bind home home\n"
+    "bind end end\n"
+    "bind backspace backspace\n"
+    "bind ctrl-h backspace\n"
+    "bind delete delete\n"
+    "bind pageup page-up\n"
+    "bind pagedown page-down\n"
+    "bind up up\n"
+    "bind down down\n"
+    "bind left left\n"
+    "bind right right\n"
+    "bind ctrl-l nop\n"
+    "bind esc nop\n"
+    "bind mouse mouse\n"
+    "bind shift-left select\n"
+    "bind shift-right select\n"
+    "bind shift-up select\n"
+    "bind shift-down select\n"
+    "bind tab tab\n"
+    "bind shift-tab outdent\n"
+    "bind ctrl-/ toggle-comment\n"
+    "bind ctrl-z undo\n"
+    "bind ctrl-g stats\n"
+    "bind ctrl-t goto\n"
+    "bind ctrl-e errors\n"
+    "bind f8 next-error\n"
+    "bind f7 prev-error\n"
+    "bind ctrl-k minimap\n"
+    "bind ctrl-b bookmark\n"
+    "bind f2 next-bookmark\n"
+    "bind f3 prev-bookmark\n"
+    "bind ctrl-x m set-mark\n"
+    "bind ctrl-x j jump-mark\n"
+    "bind ctrl-x u mem\n"
+    "autopair * {} ()\n";
+
+/**
+ * Translate a key name from the keymap file ("ctrl-s", "pageup", "x")
+ * into a key code, or -1 if it isn't recognised.
+ */
+static int editorParseKeyName(const std::string &name)
+{
+    static const struct
+    {
+        const char *name;
+        int key;
+    } named[] = {
+        {"enter", '\r'}, {"tab", '\t'}, {"esc", '\x1b'}, {"space", ' '},
+        {"backspace", BACKSPACE}, {"delete", DEL_KEY}, {"home", HOME_KEY},
+        {"end", END_KEY}, {"pageup", PAGE_UP}, {"pagedown", PAGE_DOWN},
+        {"up", ARROW_UP}, {"down", ARROW_DOWN}, {"left", ARROW_LEFT},
+        {"right", ARROW_RIGHT}, {"ctrl-up", CTRL_ARROW_UP},
+        {"ctrl-down", CTRL_ARROW_DOWN}, {"ctrl-left", CTRL_ARROW_LEFT},
+        {"ctrl-right", CTRL_ARROW_RIGHT}, {"shift-up", SHIFT_ARROW_UP},
+        {"shift-down", SHIFT_ARROW_DOWN}, {"shift-left", SHIFT_ARROW_LEFT},
+        {"shift-right", SHIFT_ARROW_RIGHT}, {"mouse", MOUSE_EVENT},
+        {"shift-tab", SHIFT_TAB}, {"ctrl-/", CTRL_KEY('_')},
+    };
+
+    for (const auto &n : named)
+    {
+        if (name == n.name)
+            return n.key;
+    }
+    if (name.size() == 6 && name.compare(0, 5, "ctrl-") == 0 && isalpha((unsigned char)name[5]))
+        return CTRL_KEY(tolower((unsigned char)name[5]));
+    if (name.size() == 1 && isprint((unsigned char)name[0]))
+        return (unsigned char)name[0];
+    if (name.size() >= 2 && name[0] == 'f' && isdigit((unsigned char)name[1]))
+    {
+        int n = atoi(name.c_str() + 1);
+        if (n >= 1 && n <= 12)
+            return F1_KEY + n - 1;
+    }
+    return -1;
+}
+
+static int editorFindCommand(const std::string &name)
+{
+    for (size_t i = 1; i < sizeof(editorCommands) / sizeof(editorCommands[0]); i++)
+    {
+        if (name == editorCommands[i].name)
+            return (int)i;
+    }
+    return -1;
+}
+
+/**
+ * Bind the key sequence 'keys' to command 'cmd', growing the trie as
+ * needed. Binding a sequence through a key that was bound on its own
+ * turns that key into a prefix.
+ */
+static void editorKeymapBind(const std::vector<int> &keys, int cmd)
+{
+    int node = 0;
+    for (size_t i = 0; i + 1 < keys.size(); i++)
+    {
+        int &entry = keymap.nodes[node][keys[i]];
+        if (entry >= 0)
+        {
+            keymap.nodes.emplace_back();
+            keymap.nodes.back().fill(KEYMAP_UNBOUND);
+            // 'entry' may dangle after emplace_back, so index again.
+            keymap.nodes[node][keys[i]] = -(int)(keymap.nodes.size() - 1);
+        }
+        node = -keymap.nodes[node][keys[i]];
+    }
+    keymap.nodes[node][keys.back()] = cmd;
+}
+
+static void editorCompileAutopairs(std::array<char, 128> &table, const std::vector<std::string> &pairs)
+{
+    table.fill('\0');
+    for (const auto &p : pairs)
+    {
+        if (p.size() == 2 && (unsigned char)p[0] < 128)
+            table[(unsigned char)p[0]] = p[1];
+    }
+}
+
+/**
+ * Set one of the save options from ~/.boltrc:
+ *   set strip-trailing-whitespace on|off
+ *   set save-tabs keep|expand|unexpand
+ *   set final-newline on|off
+ * whether the row array asks for transparent huge pages:
+ *   set huge-pages on|off
+ * and the budget for rendered rows, in bytes with an optional K, M or G
+ * (0 for no limit):
+ *   set cache-budget 64M
+ */
+static bool editorSetOption(const std::string &name, const std::string &value)
+{
+    if (name == "cache-budget")
+    {
+        char *end;
+        long long n = strtoll(value.c_str(), &end, 10);
+        const char *units = "KMG";
+        const char *unit = *end ? strchr(units, *end) : nullptr;
+        if (end == value.c_str() || n < 0 || (*end && (!unit || end[1])))
+            return false;
+        E.cache_budget = unit ? n << (10 * (unit - units + 1)) : n;
+        editorCacheTrim();
+        return true;
+    }
+
+    bool on = value == "on";
+    if (!on && value != "off" && name != "save-tabs")
+        return false;
+
+    if (name == "strip-trailing-whitespace")
+        E.save_opts.strip_trailing = on;
+    else if (name == "final-newline")
+        E.save_opts.final_newline = on;
+    else if (name == "minimap")
+        E.show_minimap = on;
+    else if (name == "huge-pages")
+        E.huge_pages = on;
+    else if (name == "save-tabs" && value == "keep")
+        E.save_opts.tabs = SAVE_TABS_KEEP;
+    else if (name == "save-tabs" && value == "expand")
+        E.save_opts.tabs = SAVE_TABS_EXPAND;
+    else if (name == "save-tabs" && value == "unexpand")
+        E.save_opts.tabs = SAVE_TABS_UNEXPAND;
+    else
+        return false;
+    return true;
+}
+
+/**
+ * Apply one line of configuration:
+ *   bind <key> [<key>...] <command>
+ *   autopair <filetype|*> [<open><close>...]
+ *   set <option> <value>
+ *   face <face> [fg=<colour>] [bg=<colour>] [bold|italic|underline|reverse...]
+ *   theme <file>
+ * Returns false if the line is malformed.
+ */
+static bool editorRcLine(const std::string &line)
+{
+    std::istringstream in(line);
+    std::vector<std::string> words;
+    std::string w;
+    while (in >> w)
+        words.push_back(w);
+
+    if (words.empty() || words[0][0] == '#')
+        return true;
+
+    if (words[0] == "bind" && words.size() >= 3)
+    {
+        int cmd = editorFindCommand(words.back());
+        if (cmd < 0)
+            return false;
+        std::vector<int> keys;
+        for (size_t i = 1; i + 1 < words.size(); i++)
+        {
+            int key = editorParseKeyName(words[i]);
+            if (key < 0)
+                return false;
+            keys.push_back(key);
+        }
+        editorKeymapBind(keys, cmd);
+        return true;
+    }
+
+    if (words[0] == "set" && words.size() == 3)
+        return editorSetOption(words[1], words[2]);
+
+    if (words[0] == "face")
+        return editorThemeLine(words, 1);
+
+    if (words[0] == "theme" && words.size() == 2)
+    {
+        std::string path = words[1];
+        const char *home = getenv("HOME");
+        if (path.compare(0, 2, "~/") == 0 && home)
+            path = home + path.substr(1);
+        return editorLoadTheme(path);
+    }
+
+    if (words[0] == "autopair" && words.size() >= 2)
+    {
+        std::vector<std::string> pairs(words.begin() + 2, words.end());
+        if (words[1] == "*")
+        {
+            editorCompileAutopairs(E.default_pair_close, pairs);
+            return true;
+        }
+        for (auto &syntax : HLDB)
+        {
+            if (syntax.filetype == words[1])
+            {
+                syntax.autopairs.clear();
+                for (const auto &p : pairs)
+                    syntax.autopairs += p;
+                editorCompileAutopairs(syntax.pair_close, pairs);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * Build the dispatch tables from the built-in defaults, then apply the
+ * user's ~/.boltrc on top if 'user_rc' is set. All parsing happens here,
+ * once, at startup.
+ */
+static void editorLoadKeymap(bool user_rc)
+{
+    editorDefaultTheme();
+    keymap.nodes.assign(1, std::array<int, KEY_COUNT>());
+    keymap.nodes[0].fill(KEYMAP_UNBOUND);
+    keymap.state = 0;
+
+    for (size_t k = 0; k < HLDB.size(); k++)
+    {
+        // Undo what an earlier ~/.boltrc did to this editor's filetypes
+        EditorSyntax &syntax = HLDB[k];
+        syntax.autopairs = HLDB_BUILTIN[k].autopairs;
+        std::vector<std::string> pairs;
+        for (size_t i = 0; i + 1 < syntax.autopairs.size(); i += 2)
+            pairs.push_back(syntax.autopairs.substr(i, 2));
+        editorCompileAutopairs(syntax.pair_close, pairs);
+    }
+
+    std::istringstream defaults(editorDefaultKeymap);
+    std::string line;
+    while (std::getline(defaults, line))
+        editorRcLine(line);
+    boltProfilePhase("default keymap");
+    if (!user_rc)
+        return;
+
+    const char *home = getenv("HOME");
+    std::ifstream rc(std::string(home ? home : ".") + "/" BOLT_RC_FILE);
+    int lineno = 0;
+    while (std::getline(rc, line))
+    {
+        lineno++;
+        if (!editorRcLine(line))
+            editorSetStatusMessage(BOLT_RC_FILE ":%d: bad line: %s", lineno, line.c_str());
+    }
+    boltProfilePhase("read " BOLT_RC_FILE);
+}
+
+/**
+ * Build the default bindings and theme the first time they are needed,
+ * unless the user's ~/.boltrc has been loaded by then. This keeps them
+ * from being built twice on the way to the first frame.
+ */
+static void editorEnsureKeymap()
+{
+    if (keymap.nodes.empty())
+        editorLoadKeymap(false);
+}
+
+/**
+ * Process a single keypress from the user by looking it up in the
+ * current keymap node. Unbound keys outside a sequence insert themselves.
+ */
+static void editorProcessKeypress()
+{
+    int c = editorReadKey();
+    if (c < 0 || c >= KEY_COUNT)
+        return;
+
+    bool in_sequence = keymap.state != 0;
+    int entry = keymap.nodes[keymap.state][c];
+    if (entry < 0)
+    {
+        keymap.state = -entry;
+        return;
+    }
+    keymap.state = 0;
+
+    if (entry == KEYMAP_UNBOUND)
+    {
+        if (in_sequence)
+        {
+            editorSetStatusMessage("Key sequence not bound");
+            return;
+        }
+        entry = CMD_SELF_INSERT;
+    }
+
+    editorCommands[entry].fn(c);
+    if (!editorCommands[entry].keeps_selection)
+        E.sel_active = false;
+
+    // Reset quit_times if the user does anything else
+    if (entry != CMD_QUIT)
+        quit_times = KILO_QUIT_TIMES;
+}
+
+/*** init ***/
+
+/**
+ * Initialize the editor for a screen of 'rows' x 'cols' and reset the
+ * state variables.
+ */
+static void initEditor(int rows, int cols)
+{
+    E = editorConfig();
+
+    // Make room for status bar and message bar
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+}
+
+/*** editor API ***/
+
+/*
+ * Everything one BoltEditor owns. The rest of the file reaches it
+ * through the bound_* pointers while a call into the editor runs.
+ */
+struct BoltEditorState
+{
+    editorConfig config;                            // E
+    std::vector<EditorSyntax> hldb = HLDB_BUILTIN;  // HLDB
+    editorTheme faces;                              // theme
+    editorScreen display;                           // screen
+    editorInput decoder;                            // input
+    editorKeymap bindings;                          // keymap
+    editorTermCaps caps;                            // termcaps
+    int quits_left = KILO_QUIT_TIMES;               // quit_times
+    const BoltTerminal *terminal = nullptr;         // term
+};
+
+/**
+ * Point the bound_* pointers at 's', or at nothing.
+ */
+static void editorBind(BoltEditorState *s)
+{
+    bound_state = s;
+    bound_config = s ? &s->config : nullptr;
+    bound_hldb = s ? &s->hldb : nullptr;
+    bound_theme = s ? &s->faces : nullptr;
+    bound_screen = s ? &s->display : nullptr;
+    bound_input = s ? &s->decoder : nullptr;
+    bound_keymap = s ? &s->bindings : nullptr;
+    bound_termcaps = s ? &s->caps : nullptr;
+    bound_quit_times = s ? &s->quits_left : nullptr;
+    bound_term = s ? &s->terminal : nullptr;
+}
+
+/*
+ * Binds an editor to this thread for a call. A call into another editor
+ * made from one of its BoltTerminal hooks rebinds the caller afterwards.
+ */
+struct editorActive
+{
+    BoltEditorState *outer;
+
+    explicit editorActive(BoltEditorState &s) : outer(bound_state)
+    {
+        editorBind(&s);
+    }
+    ~editorActive()
+    {
+        editorBind(outer);
+    }
+};
+
+BoltEditor::BoltEditor(int rows, int cols, const BoltTerminal *terminal)
+{
+    static std::once_flag tables_built;
+    std::call_once(tables_built, editorInitInputTable);
+
+    state = new BoltEditorState;
+    state->terminal = terminal;
+    editorActive active(*state);
+    initEditor(rows, cols);
+}
+
+BoltEditor::~BoltEditor()
+{
+    delete state;
+}
+
+void BoltEditor::loadConfig()
+{
+    editorActive active(*state);
+    editorLoadKeymap(true);
+}
+
+void BoltEditor::resize(int rows, int cols)
+{
+    editorActive active(*state);
+    E.screenrows = rows - 2;
+    E.screencols = cols;
+}
+
+void BoltEditor::setStatus(const std::string &msg)
+{
+    editorActive active(*state);
+    editorSetStatusMessage("%s", msg.c_str());
+}
+
+bool BoltEditor::open(const std::string &filename)
+{
+    editorActive active(*state);
+    return editorOpenBuffer(filename, 0, 0, 0, 0);
+}
+
+void BoltEditor::openFiles(const std::vector<std::string> &files)
+{
+    editorActive active(*state);
+    editorRestoreSession(files);
+}
+
+void BoltEditor::openErrors(const std::string &text)
+{
+    editorActive active(*state);
+    editorOpenErrorsText(text);
+}
+
+void BoltEditor::loadAll()
+{
+    editorActive active(*state);
+    editorLoadAll();
+}
+
+int BoltEditor::lines()
+{
+    editorActive active(*state);
+    return (int)E.rows.size();
+}
+
+std::string BoltEditor::text()
+{
+    editorActive active(*state);
+    return editorRowsToString();
+}
+
+BoltMemory BoltEditor::memory()
+{
+    editorActive active(*state);
+    return editorMemUsage();
+}
+
+void BoltEditor::insertLine(int at, const std::string &text)
+{
+    editorActive active(*state);
+    editorInsertRow(std::max(0, std::min(at, (int)E.rows.size())), text);
+}
+
+void BoltEditor::updateRow(int at)
+{
+    editorActive active(*state);
+    editorUpdateRow(E.rows.at(at));
+}
+
+void BoltEditor::updateSyntax(int at)
+{
+    editorActive active(*state);
+    (void)E.rows.at(at); // The same range check as the other row calls
+    editorUpdateSyntax(editorRowCached(at));
+}
+
+int BoltEditor::cxToRx(int at, int cx)
+{
+    editorActive active(*state);
+    return editorRowCxToRx(E.rows.at(at), cx);
+}
+
+void BoltEditor::setFilename(const std::string &filename)
+{
+    editorActive active(*state);
+    editorSetFilename(filename);
+    editorSelectSyntaxHighlight();
+    editorUpdateRows(0, (int)E.rows.size());
+}
+
+bool BoltEditor::isSeparator(int c)
+{
+    return is_separator(c);
+}
+
+/**
+ * The encoding named 'name', as editorEncodingName spells it, or -1.
+ */
+static int editorEncodingByName(const std::string &name)
+{
+    for (int enc = ENC_UTF8; enc <= ENC_LATIN1; enc++)
+        if (name == editorEncodingName(enc))
+            return enc;
+    return -1;
+}
+
+bool BoltEditor::decode(const std::string &encoding, const std::string &bytes, std::string &text)
+{
+    int enc = editorEncodingByName(encoding);
+    if (enc == -1)
+        return false;
+    std::string carry;
+    text.clear();
+    editorDecode(enc, carry, (const unsigned char *)bytes.data(), bytes.size(), text);
+    editorDecodeEnd(carry, text);
+    return true;
+}
+
+bool BoltEditor::encode(const std::string &encoding, const std::string &text, std::string &bytes)
+{
+    int enc = editorEncodingByName(encoding);
+    if (enc == -1)
+        return false;
+    bytes.clear();
+    editorEncode(enc, text.data(), text.size(), bytes);
+    return true;
+}
+
+bool BoltEditor::find(const std::string &query, int &row, int &col)
+{
+    editorActive active(*state);
+    editorLoadAll();
+    int n = (int)E.rows.size();
+    if (query.empty() || n == 0)
+        return false;
+
+    int y = std::max(0, std::min(row, n - 1));
+    size_t from = col < 0 ? 0 : (size_t)col + 1;
+    // One extra step comes back round to the start of the first row
+    for (int i = 0; i <= n; i++, y = (y + 1) % n, from = 0)
+    {
+        size_t pos = E.rows[y].chars.find(query, from);
+        if (pos != std::string::npos)
+        {
+            row = y;
+            col = (int)pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BoltEditor::feed(const char *bytes, size_t len)
+{
+    editorActive active(*state);
+    editorEnsureKeymap();
+    editorInputFeed((const unsigned char *)bytes, len);
+    editorInputTimeout(); // Nothing else is coming: a trailing ESC is a key
+    while (!input.events.empty())
+        editorProcessKeypress();
+}
+
+bool BoltEditor::idle()
+{
+    editorActive active(*state);
+    if (!editorIdlePending())
+        return false;
+    editorIdleWork();
+    return true;
+}
+
+const std::string &BoltEditor::render()
+{
+    editorActive active(*state);
+    editorEnsureKeymap();
+    editorRefreshScreen();
+    return screen.frame;
+}
+
+void BoltEditor::run()
+{
+    editorActive active(*state);
+    if (!term)
+        return;
+    editorEnsureKeymap();
+    while (true)
+    {
+        editorRefreshScreen();
+        // Handle everything already queued (e.g. a burst of wheel events)
+        // before drawing the next frame.
+        do
+        {
+            editorProcessKeypress();
+        } while (editorInputPending());
+    }
+}
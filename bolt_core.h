@@ -0,0 +1,137 @@
+#ifndef BOLT_CORE_H
+#define BOLT_CORE_H
+
+#include <sys/types.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+ * libbolt-core: the editor without a terminal. Buffers, rows, syntax
+ * highlighting, search, input decoding and frame rendering live here;
+ * Bolt.cpp is the terminal front end built on top.
+ *
+ * Each BoltEditor owns all of its state, filetypes included, so several
+ * can live in one process. A call binds its editor to the calling thread
+ * for as long as it runs, so editors on different threads run at the
+ * same time, run() included. One editor must not be called from two
+ * threads at once.
+ *
+ * The API is one class rather than one per area. A buffer's rows, its
+ * filetype, its search state and the screen drawn from them all live in
+ * the editor's state and change together, as switching buffers swaps
+ * which rows and syntax are active, so separate buffer, row, syntax and
+ * search objects would only be handles onto the same editor. The
+ * methods are grouped by area instead.
+ */
+
+/*
+ * Queries whose replies the core's input parser understands: XTVERSION,
+ * the synchronized output mode, and the secondary and primary device
+ * attributes. A front end writes them once at startup and passes the
+ * replies in with the rest of the input; nothing waits for them.
+ */
+#define BOLT_PROBE "\x1b[>q\x1b[?2026$p\x1b[>c\x1b[c"
+
+/*
+ * How the core reaches a terminal. The front end provides these; an
+ * editor created without them is headless.
+ */
+struct BoltTerminal
+{
+    ssize_t (*read)(unsigned char *buf, size_t len); // Bytes typed, or 0 after a short timeout
+    bool (*pending)();                                // True if input is ready without blocking
+    void (*write)(const char *buf, size_t len);       // Send a frame
+    void (*quit)();                                   // The user quit; doesn't return
+};
+
+/*
+ * Startup profiling (Bolt --startuptime FILE). Once started, the core
+ * and the front end each mark the end of a startup phase, and a line
+ * per phase is written to 'out' until the first frame is out.
+ */
+void boltProfileStart(FILE *out);
+void boltProfilePhase(const char *name);
+
+/*
+ * Heap bytes held by each part of an editor, across all its open buffers.
+ */
+struct BoltMemory
+{
+    long long text;   // Row text
+    long long render; // Rendered rows (tabs expanded) and their column maps
+    long long hl;     // Highlight classes, one per rendered column
+    long long rows;   // The row records themselves
+    long long undo;   // Undo groups
+    long long index;  // Offset and shade trees, search matches, anchors, stats
+    long long cache;  // Loader buffers, the screen grids and the last frame
+    long long lines;  // Rows in all buffers, for the per-row overhead
+};
+
+struct BoltEditorState;
+
+class BoltEditor
+{
+public:
+    /**
+     * An editor for a screen of 'rows' x 'cols', the status and message
+     * bars included, with the built-in key bindings and theme.
+     */
+    explicit BoltEditor(int rows = 24, int cols = 80, const BoltTerminal *term = nullptr);
+    ~BoltEditor();
+    BoltEditor(const BoltEditor &) = delete;
+    BoltEditor &operator=(const BoltEditor &) = delete;
+
+    // Setup
+    void loadConfig(); // Apply ~/.boltrc
+    void resize(int rows, int cols);
+    void setStatus(const std::string &msg);
+
+    // Buffers
+    bool open(const std::string &filename); // Only the first screenful is read; see idle()
+    void openFiles(const std::vector<std::string> &files); // Or the last session if empty
+    void openErrors(const std::string &text); // Piped compiler/grep output
+    void loadAll();
+    int lines();
+    std::string text(); // The rows joined with newlines
+    BoltMemory memory();
+
+    // Rows
+    void insertLine(int at, const std::string &text);
+    void updateRow(int at);            // Re-render and re-highlight one row
+    void updateSyntax(int at);         // Re-highlight only
+    int cxToRx(int at, int cx);        // Character index to render column
+    void setFilename(const std::string &filename); // Picks the syntax too
+    static bool isSeparator(int c);
+
+    // Encodings: "utf-8", "utf-16le", "utf-16be" or "latin-1". These
+    // return false for any other name.
+    static bool decode(const std::string &encoding, const std::string &bytes, std::string &text); // To UTF-8
+    static bool encode(const std::string &encoding, const std::string &text, std::string &bytes); // From UTF-8
+
+    // Search
+    /**
+     * Find the first match of 'query' after (row, col), wrapping around
+     * the end, loading the rest of the file first. Returns false if
+     * there is none.
+     */
+    bool find(const std::string &query, int &row, int &col);
+
+    // Input and output
+    /**
+     * Decode 'len' bytes of terminal input and run what they bind to. A
+     * prompt they open is answered by the rest of them; if the bytes run
+     * out first it is cancelled.
+     */
+    void feed(const char *bytes, size_t len);
+    bool idle(); // Load one chunk in the background; false once there is nothing left
+    const std::string &render(); // Draw a frame; returns the bytes a terminal would be sent,
+                                 // valid until the next render() on this editor
+    void run();                  // Interact with the terminal until the user quits
+
+private:
+    BoltEditorState *state;
+};
+
+#endif
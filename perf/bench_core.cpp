@@ -0,0 +1,515 @@
+/*** includes ***/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "bolt_core.h"
+
+/*
+ * bench_core: micro-benchmarks for the core's per-row kernels, run
+ * through the BoltEditor API the way Google Benchmark would run them.
+ *
+ *     bench_core [--benchmark_filter=REGEX] [--benchmark_min_time=SECONDS]
+ *                [--benchmark_out=FILE]
+ *
+ * Every kernel runs over generated C-like rows of each length in
+ * benchLengths, with each in benchTabs percent of the gaps between
+ * tokens being a tab. A case repeats, doubling its iterations, until it
+ * has run for the minimum time. The results, with the page faults taken
+ * per iteration, go to stdout as a table and, with --benchmark_out, to a
+ * JSON file in Google Benchmark's format so existing tools can compare
+ * runs. A case that fails its check makes the run exit with status 1.
+ */
+
+/*** defines ***/
+
+#define BENCH_MIN_TIME 0.1
+#define BENCH_BUFFER_BYTES (4 << 20) // Buffer size for the whole-buffer kernels
+#define BENCH_SCREEN_ROWS 50
+#define BENCH_SCREEN_COLS 200
+#define BENCH_REGION_ROWS 10 // Fewer than a screen, so one page down reaches the virtual row
+
+/*** data ***/
+
+static const int benchLengths[] = {80, 1024, 16384};
+static const int benchTabs[] = {0, 10, 50};
+
+struct benchResult
+{
+    std::string name;
+    long long iterations;
+    double real_ns; // Per iteration
+    double cpu_ns;
+    double bytes;   // Processed per iteration, 0 if not meaningful
+    double minflt;  // Page faults per iteration, as a user counter
+    double majflt;
+    bool ok;        // The case's check passed
+};
+
+/*
+ * One case: 'setup' builds the editor and returns the bytes each call of
+ * the body processes; 'body' is what is timed. If there is a 'check', it
+ * runs on the editor afterwards and the case fails if it returns false.
+ */
+struct benchCase
+{
+    std::string name;
+    std::function<double(BoltEditor &)> setup;
+    std::function<void(BoltEditor &)> body;
+    std::function<bool(BoltEditor &)> check = nullptr;
+};
+
+static volatile int benchSink; // Keeps results the compiler could drop
+static std::vector<std::string> benchFiles; // Temporary files, removed on exit
+
+static const char *benchWords[] = {"if", "return", "static", "int", "count", "buffer", "render", "0x1f",
+                                   "42", "\"text\"", "(", ")", "+=", "*", "row", "{", "}", ";"};
+
+// Terminal input for the parser: keys, mouse reports, probe replies and
+// strings a terminal sends, whole or cut short
+static const char *benchSequences[] = {
+    "\x1b[A", "\x1b[B", "\x1b[C", "\x1b[D", "\x1b[1;2C", "\x1b[1;5A", "\x1b[5~", "\x1b[6~", "\x1b[3~",
+    "\x1b[H", "\x1b[F", "\x1b[Z", "\x1bOH", "\x1bOF", "\x1bOP", "\x1b[18~", "\x1b[<0;12;7M", "\x1b[<0;12;7m",
+    "\x1b[<32;40;9M", "\x1b[<64;1;1M", "\x1bP>|xterm(390)\x1b\\", "\x1b[?2026;2$y", "\x1b[>41;390;0c",
+    "\x1b[?62;22c", "\x1b]11;rgb:0000/0000/0000\x07", "\x1b_Gi=1;OK\x1b\\", "\x1b", "\x1b\x1b"};
+// Input that decodes to nothing to do: replies to the startup probe,
+// strings and mouse motion with no button held
+static const char *benchReplies[] = {
+    "\x1bP>|xterm(390)\x1b\\", "\x1b[?2026;2$y", "\x1b[>41;390;0c", "\x1b[?62;22c",
+    "\x1b]11;rgb:0000/0000/0000\x07", "\x1b_Gi=1;OK\x1b\\", "\x1b[<35;12;7M", "\x1b[<35;140;48M"};
+static const char *benchText[] = {"e", "x", " ", "{", "}", "(", "\"", "//", "\xc3\xa9", "\xe2\x86\x92",
+                                  "\xf0\x9f\x98\x80", "\r", "\t", "\x7f"};
+
+#define BENCH_INPUT_MARKER "bench-input-ok"
+
+static const char *benchEncodings[] = {"utf-16le", "utf-16be", "latin-1"};
+
+/*** helpers ***/
+
+static double benchNow(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void benchFaults(long &minflt, long &majflt)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    minflt = ru.ru_minflt;
+    majflt = ru.ru_majflt;
+}
+
+/**
+ * A row of 'len' bytes of C-like tokens where about 'tabs' percent of the
+ * gaps are tabs, the same for the same arguments.
+ */
+static std::string benchRow(int len, int tabs, uint64_t seed)
+{
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ (seed * 0xBF58476D1CE4E5B9ULL);
+    std::string row;
+    row.reserve(len + 16);
+    while ((int)row.size() < len)
+    {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        uint64_t r = (rng * 0x2545F4914F6CDD1DULL) >> 32;
+        if (!row.empty())
+            row += (int)(r % 100) < tabs ? '\t' : ' ';
+        row += benchWords[(r >> 8) % (sizeof(benchWords) / sizeof(benchWords[0]))];
+    }
+    row.resize(len);
+    return row;
+}
+
+/**
+ * 'len' bytes of seeded random terminal input: typing, including UTF-8
+ * and Enter, Tab and Backspace, mixed with escape sequences of which
+ * about a third are cut off at a random point. Other control bytes are
+ * left out since they run commands such as save and open. Without
+ * 'typing' it is only benchReplies, whole or cut off, so nearly all the
+ * time goes to the parser.
+ */
+static std::string benchInput(size_t len, uint64_t seed, bool typing)
+{
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ (seed * 0xBF58476D1CE4E5B9ULL);
+    std::string out;
+    out.reserve(len + 64);
+    while (out.size() < len)
+    {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        uint64_t r = (rng * 0x2545F4914F6CDD1DULL) >> 16;
+        if (typing && r % 4 != 0)
+        {
+            out += benchText[(r >> 4) % (sizeof(benchText) / sizeof(benchText[0]))];
+            continue;
+        }
+        std::string seq = typing ? benchSequences[(r >> 4) % (sizeof(benchSequences) / sizeof(benchSequences[0]))]
+                                 : benchReplies[(r >> 4) % (sizeof(benchReplies) / sizeof(benchReplies[0]))];
+        if ((r >> 12) % 3 == 0)
+            seq.resize(1 + (r >> 16) % seq.size());
+        out += seq;
+    }
+    out.resize(len);
+    return out;
+}
+
+/**
+ * About 'bytes' of newline-separated rows of the case's shape. With
+ * 'accents', every eighth gap is an e-acute instead, which all the
+ * encodings can hold, so the text leaves the ASCII fast paths often.
+ */
+static std::string benchUtf8(int len, int tabs, long long bytes, bool accents)
+{
+    std::string text;
+    text.reserve(bytes + len);
+    for (long long i = 0; (long long)text.size() < bytes; i++)
+    {
+        std::string row = benchRow(len, tabs, (uint64_t)i);
+        for (size_t k = 0, gaps = 0; accents && k < row.size(); k++)
+            if (row[k] == ' ' && ++gaps % 8 == 0)
+                row.replace(k, 1, "\xc3\xa9");
+        text += row;
+        text += '\n';
+    }
+    return text;
+}
+
+/**
+ * Fill 'editor' with rows of the case's shape up to about 'bytes' bytes,
+ * highlighted as C.
+ */
+static double benchFill(BoltEditor &editor, int len, int tabs, long long bytes)
+{
+    int rows = (int)std::max(1LL, bytes / (len + 1));
+    for (int i = 0; i < rows; i++)
+        editor.insertLine(i, benchRow(len, tabs, (uint64_t)i));
+    editor.setFilename("bench.c");
+    return (double)rows * (len + 1);
+}
+
+/**
+ * Write rows of the case's shape, about 'bytes' in all, to a temporary
+ * file and return its name.
+ */
+static std::string benchFile(int len, int tabs, long long bytes)
+{
+    char path[] = "/tmp/bench_core.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+        return "";
+    FILE *out = fdopen(fd, "w");
+    for (long long i = 0, n = std::max(1LL, bytes / (len + 1)); i < n; i++)
+        fprintf(out, "%s\n", benchRow(len, tabs, (uint64_t)i).c_str());
+    fclose(out);
+    benchFiles.push_back(path);
+    return path;
+}
+
+/*** cases ***/
+
+static std::vector<benchCase> benchCases()
+{
+    std::vector<benchCase> cases;
+    for (int len : benchLengths)
+    {
+        for (int tabs : benchTabs)
+        {
+            std::string args = "/len:" + std::to_string(len) + "/tabs:" + std::to_string(tabs);
+            auto one_row = [len, tabs](BoltEditor &e) { return benchFill(e, len, tabs, 0); };
+
+            cases.push_back({"BM_UpdateRow" + args, one_row, [](BoltEditor &e) { e.updateRow(0); }});
+            cases.push_back({"BM_UpdateSyntax" + args, one_row, [](BoltEditor &e) { e.updateSyntax(0); }});
+            cases.push_back({"BM_RowCxToRx" + args, one_row, [len](BoltEditor &e) { e.cxToRx(0, len); }});
+
+            std::string row = benchRow(len, tabs, 0);
+            cases.push_back({"BM_IsSeparator" + args, [len](BoltEditor &) { return (double)len; },
+                             [row](BoltEditor &) {
+                                 int n = 0;
+                                 for (char c : row)
+                                     n += BoltEditor::isSeparator((unsigned char)c);
+                                 benchSink = n;
+                             }});
+
+            // Drawing an unchanged screen: the frame is assembled and
+            // diffed, but next to nothing is sent
+            cases.push_back({"BM_DrawRows" + args,
+                             [len, tabs](BoltEditor &e) {
+                                 benchFill(e, len, tabs, (long long)BENCH_SCREEN_ROWS * (len + 1));
+                                 e.render();
+                                 return 0.0;
+                             },
+                             [](BoltEditor &e) { e.render(); }});
+            // A resize forgets what the terminal shows, so every frame is
+            // sent in full
+            cases.push_back({"BM_DrawRowsFull" + args,
+                             [len, tabs](BoltEditor &e) {
+                                 benchFill(e, len, tabs, (long long)BENCH_SCREEN_ROWS * (len + 1));
+                                 return 0.0;
+                             },
+                             [](BoltEditor &e) {
+                                 static bool odd;
+                                 odd = !odd;
+                                 e.resize(BENCH_SCREEN_ROWS + odd, BENCH_SCREEN_COLS);
+                                 e.render();
+                             }});
+
+            auto buffer = [len, tabs](BoltEditor &e) { return benchFill(e, len, tabs, BENCH_BUFFER_BYTES); };
+            cases.push_back({"BM_RowsToString" + args, buffer, [](BoltEditor &e) { e.text(); }});
+            // Reading a file into a new editor, where most page faults are
+            auto file = std::make_shared<std::string>();
+            cases.push_back({"BM_Load" + args,
+                             [len, tabs, file](BoltEditor &) {
+                                 *file = benchFile(len, tabs, BENCH_BUFFER_BYTES);
+                                 return (double)BENCH_BUFFER_BYTES;
+                             },
+                             [file](BoltEditor &) {
+                                 BoltEditor fresh(BENCH_SCREEN_ROWS, BENCH_SCREEN_COLS);
+                                 fresh.open(*file);
+                                 fresh.loadAll();
+                                 benchSink = fresh.lines();
+                             }});
+            // Enter half way down the buffer and the frame after it, with
+            // the overview ruler shown: the status bar needs the cursor's
+            // byte offset and the ruler the shades of every run of rows
+            cases.push_back({"BM_SplitLine" + args,
+                             [len, tabs](BoltEditor &e) {
+                                 benchFill(e, len, tabs, BENCH_BUFFER_BYTES);
+                                 static const char keys[] = "\x14#" "2097152\r\x0b"; // Goto the offset, ruler on
+                                 e.feed(keys, sizeof(keys) - 1);
+                                 e.render();
+                                 return 0.0;
+                             },
+                             [](BoltEditor &e) {
+                                 e.feed("\r", 1);
+                                 e.render();
+                             }});
+            // Ctrl-F and a query that isn't there, typed as a user would:
+            // each key collects the matching rows for the overview ruler
+            // and searches from the cursor, drawing the prompt in between
+            cases.push_back({"BM_Search" + args, buffer, [](BoltEditor &e) {
+                                 static const char keys[] = "\x06needle\r";
+                                 e.feed(keys, sizeof(keys) - 1);
+                             }});
+            // Indent, outdent, comment and uncomment the last row with the
+            // selection reaching up to it from the virtual row past the end.
+            // The keys undo each other, so the text must come back unchanged
+            auto before = std::make_shared<std::string>();
+            cases.push_back({"BM_IndentRegion" + args,
+                             [len, tabs, before](BoltEditor &e) {
+                                 benchFill(e, len, tabs, (long long)BENCH_REGION_ROWS * (len + 1));
+                                 static const char keys[] = "\x1b[6~\x1b[1;2A"; // Page down to the end, shift-up
+                                 e.feed(keys, sizeof(keys) - 1);
+                                 *before = e.text();
+                                 return 0.0;
+                             },
+                             [](BoltEditor &e) {
+                                 static const char keys[] = "\t\x1b[Z\x1f\x1f"; // Tab, shift-tab, ctrl-/ twice
+                                 e.feed(keys, sizeof(keys) - 1);
+                             },
+                             [before](BoltEditor &e) { return e.text() == *before; }});
+        }
+    }
+    // Transcoding a file's worth of rows from and to each encoding the
+    // loader reads. Decoding must give back the text that was encoded
+    for (const char *encoding : benchEncodings)
+    {
+        for (int accents = 0; accents <= 1; accents++)
+        {
+            std::string args = std::string("/") + encoding + (accents ? "/accents" : "/ascii");
+            auto text = std::make_shared<std::string>(benchUtf8(80, 10, BENCH_BUFFER_BYTES, accents));
+            auto bytes = std::make_shared<std::string>();
+            auto out = std::make_shared<std::string>();
+            BoltEditor::encode(encoding, *text, *bytes);
+            cases.push_back({"BM_Decode" + args, [bytes](BoltEditor &) { return (double)bytes->size(); },
+                             [encoding, bytes, out](BoltEditor &) { BoltEditor::decode(encoding, *bytes, *out); },
+                             [text, out](BoltEditor &) { return *out == *text; }});
+            cases.push_back({"BM_Encode" + args, [text](BoltEditor &) { return (double)text->size(); },
+                             [encoding, text, out](BoltEditor &) { BoltEditor::encode(encoding, *text, *out); },
+                             [bytes, out](BoltEditor &) { return *out == *bytes; }});
+        }
+    }
+    // Random terminal input through feed(): BM_InputParse is the parser on
+    // its own, BM_InputFeed also runs the keys. Afterwards a line typed on
+    // its own must come through, so nothing crashed or left the parser stuck
+    auto typed = [](BoltEditor &e) {
+        static const char marker[] = "\r" BENCH_INPUT_MARKER;
+        e.feed(marker, sizeof(marker) - 1);
+        return e.text().find(BENCH_INPUT_MARKER) != std::string::npos;
+    };
+    for (int typing = 0; typing <= 1; typing++)
+    {
+        for (int len : benchLengths)
+        {
+            size_t bytes = (size_t)len * 4;
+            std::string input = benchInput(bytes, (uint64_t)len, typing);
+            cases.push_back({(typing ? "BM_InputFeed/len:" : "BM_InputParse/len:") + std::to_string(bytes),
+                             [bytes](BoltEditor &) { return (double)bytes; },
+                             [input](BoltEditor &e) { e.feed(input.data(), input.size()); }, typed});
+        }
+    }
+    return cases;
+}
+
+/*** runner ***/
+
+static benchResult benchRun(const benchCase &c, double min_time)
+{
+    BoltEditor editor(BENCH_SCREEN_ROWS, BENCH_SCREEN_COLS);
+    benchResult r = {c.name, 0, 0, 0, c.setup(editor), 0, 0, true};
+
+    long long iterations = 1;
+    while (true)
+    {
+        long minflt0, majflt0, minflt, majflt;
+        benchFaults(minflt0, majflt0);
+        double real0 = benchNow(CLOCK_MONOTONIC), cpu0 = benchNow(CLOCK_PROCESS_CPUTIME_ID);
+        for (long long i = 0; i < iterations; i++)
+            c.body(editor);
+        double real = benchNow(CLOCK_MONOTONIC) - real0, cpu = benchNow(CLOCK_PROCESS_CPUTIME_ID) - cpu0;
+        benchFaults(minflt, majflt);
+
+        if (real >= min_time * 1e9 || iterations >= (1LL << 40))
+        {
+            r.iterations = iterations;
+            r.real_ns = real / iterations;
+            r.cpu_ns = cpu / iterations;
+            r.minflt = (double)(minflt - minflt0) / iterations;
+            r.majflt = (double)(majflt - majflt0) / iterations;
+            if (c.check)
+                r.ok = c.check(editor);
+            return r;
+        }
+        // Aim for the minimum time with some margin, as Google Benchmark does
+        double want = real > 0 ? iterations * min_time * 1e9 * 1.4 / real : iterations * 10.0;
+        iterations = (long long)std::min(std::max(want, iterations * 2.0), iterations * 10.0);
+    }
+}
+
+static void benchJsonString(FILE *out, const std::string &s)
+{
+    fputc('"', out);
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            fputc('\\', out);
+        fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static bool benchWriteJson(const std::string &path, const std::vector<benchResult> &results, const char *exe)
+{
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out)
+        return false;
+
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    char date[64];
+    time_t now = time(nullptr);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+    fprintf(out, "{\n  \"context\": {\n    \"date\": ");
+    benchJsonString(out, date);
+    fprintf(out, ",\n    \"host_name\": ");
+    benchJsonString(out, host);
+    fprintf(out, ",\n    \"executable\": ");
+    benchJsonString(out, exe);
+    fprintf(out, ",\n    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+#ifdef __OPTIMIZE__
+    fprintf(out, "    \"library_build_type\": \"release\"\n  },\n");
+#else
+    fprintf(out, "    \"library_build_type\": \"debug\"\n  },\n");
+#endif
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const benchResult &r = results[i];
+        fprintf(out, "    {\n      \"name\": ");
+        benchJsonString(out, r.name);
+        fprintf(out, ",\n      \"run_name\": ");
+        benchJsonString(out, r.name);
+        fprintf(out, ",\n      \"run_type\": \"iteration\",\n      \"iterations\": %lld,\n", r.iterations);
+        fprintf(out, "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\"", r.real_ns,
+                r.cpu_ns);
+        if (r.bytes > 0)
+            fprintf(out, ",\n      \"bytes_per_second\": %.1f", r.bytes * 1e9 / r.real_ns);
+        fprintf(out, ",\n      \"minor_faults\": %.3f,\n      \"major_faults\": %.3f", r.minflt, r.majflt);
+        fprintf(out, "\n    }%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+/*** main ***/
+
+int main(int argc, char *argv[])
+{
+    std::regex filter(".*");
+    double min_time = BENCH_MIN_TIME;
+    std::string json;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        size_t eq = arg.find('=');
+        std::string key = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+        if (key == "--benchmark_filter")
+            filter = std::regex(value);
+        else if (key == "--benchmark_min_time")
+            min_time = atof(value.c_str());
+        else if (key == "--benchmark_out")
+            json = value;
+        else
+        {
+            fprintf(stderr, "usage: bench_core [--benchmark_filter=REGEX] [--benchmark_min_time=SECONDS] "
+                            "[--benchmark_out=FILE]\n");
+            return 2;
+        }
+    }
+
+    std::vector<benchResult> results;
+    bool failed = false;
+    printf("%-36s %14s %14s %12s %10s %10s\n", "Benchmark", "Time", "CPU", "Iterations", "Faults", "MB/s");
+    for (const benchCase &c : benchCases())
+    {
+        if (!std::regex_search(c.name, filter))
+            continue;
+        benchResult r = benchRun(c, min_time);
+        printf("%-36s %11.0f ns %11.0f ns %12lld %10.2f", r.name.c_str(), r.real_ns, r.cpu_ns, r.iterations,
+               r.minflt + r.majflt);
+        if (r.bytes > 0)
+            printf(" %10.1f", r.bytes * 1e3 / r.real_ns);
+        if (!r.ok)
+            printf("  CHECK FAILED");
+        printf("\n");
+        failed |= !r.ok;
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    for (const std::string &path : benchFiles)
+        unlink(path.c_str());
+    if (!json.empty() && !benchWriteJson(json, results, argv[0]))
+    {
+        perror(json.c_str());
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
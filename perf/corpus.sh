@@ -0,0 +1,16 @@
+#!/bin/sh
+# Generate the benchmark corpus into the directory given as $1, using
+# gencorpus (built by make). The output is deterministic; PERF_SCALE
+# multiplies the sizes.
+
+set -e
+out=${1:?usage: corpus.sh DIR}
+scale=${PERF_SCALE:-1}
+gen=$(dirname "$0")/gencorpus
+mkdir -p "$out"
+
+"$gen" log $((90 * scale))M -o "$out/huge.log"         # ~1M lines
+"$gen" crlf $((20 * scale))M -o "$out/crlf.log"
+"$gen" json $((3 * scale))M -w 140K -o "$out/long_lines.json"
+"$gen" tabs $((3 * scale))M -o "$out/tabs.c"
+"$gen" nested $((8 * scale))M -o "$out/nested.c"       # 100 levels deep
@@ -0,0 +1,410 @@
+/*** includes ***/
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+
+/*
+ * gencorpus: write deterministic benchmark inputs of a given size.
+ *
+ *     gencorpus KIND SIZE [-s SEED] [-w WIDTH] [-o FILE]
+ *
+ * KIND is one of c, log, json, tabs, crlf, nested or binary. SIZE takes a
+ * K, M or G suffix (powers of 1024) and the output is exactly that long,
+ * so the last line may be cut short. WIDTH is the line length for json
+ * (default 128K). The same arguments always give the same bytes.
+ *
+ * Records are formatted by hand into a buffer that is written out a
+ * megabyte at a time, so the tool keeps up with the disk.
+ */
+
+/*** defines ***/
+
+#define GEN_BLOCK (1 << 20)
+#define GEN_JSON_WIDTH (128 << 10)
+
+/*** data ***/
+
+struct genState
+{
+    uint64_t rng;
+    std::string out;   // Buffered output, flushed every GEN_BLOCK bytes
+    long long counter; // Records written so far
+    long long width;   // Line length for json
+    long long line;    // Bytes on the current json line
+    int depth;         // Nesting level for nested
+};
+
+static const std::string genWords[] = {
+    "alpha", "buffer", "cursor", "delta", "editor", "frame", "glyph", "handle",
+    "index", "journal", "kernel", "layout", "marker", "node", "offset", "parser",
+    "query", "render", "screen", "token", "undo", "vector", "window", "yank"};
+static const std::string genKeywords[] = {"if", "while", "for", "return", "switch", "case", "break", "static"};
+static const std::string genTypes[] = {"int", "long", "char", "double", "unsigned", "float", "void", "size_t"};
+static const std::string genLevels[] = {"INFO ", "INFO ", "INFO ", "DEBUG", "WARN ", "ERROR"};
+static const std::string genComponents[] = {"http", "db", "cache", "auth", "queue", "sched"};
+
+#define GEN_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+/*** helpers ***/
+
+/**
+ * xorshift64*: fast, and the same sequence on every platform.
+ */
+static uint64_t genRand(genState &g)
+{
+    g.rng ^= g.rng >> 12;
+    g.rng ^= g.rng << 25;
+    g.rng ^= g.rng >> 27;
+    return g.rng * 0x2545F4914F6CDD1DULL;
+}
+
+static unsigned genBelow(genState &g, unsigned n)
+{
+    return (unsigned)((genRand(g) >> 32) % n);
+}
+
+static const std::string &genPick(genState &g, const std::string *table, size_t n)
+{
+    return table[genBelow(g, (unsigned)n)];
+}
+
+static void genNumber(std::string &out, unsigned long long n)
+{
+    char buf[24];
+    char *p = buf + sizeof(buf);
+    do
+    {
+        *--p = (char)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    out.append(p, buf + sizeof(buf) - p);
+}
+
+/**
+ * Append 'n' as exactly 'digits' digits, zero padded.
+ */
+static void genPadded(std::string &out, unsigned long long n, int digits)
+{
+    size_t at = out.size();
+    out.append(digits, '0');
+    for (int i = digits - 1; i >= 0 && n; i--, n /= 10)
+        out[at + i] = (char)('0' + n % 10);
+}
+
+static void genSentence(genState &g, std::string &out, int words)
+{
+    for (int i = 0; i < words; i++)
+    {
+        if (i)
+            out += ' ';
+        out += genPick(g, genWords, GEN_COUNT(genWords));
+    }
+}
+
+/*** kinds ***/
+
+/*
+ * Each generator appends one record (a line or a small block) to g.out.
+ */
+
+static void genLog(genState &g, const char *eol)
+{
+    long long i = g.counter;
+    std::string &out = g.out;
+    out += "2024-03-";
+    genPadded(out, 1 + i / 86400000 % 28, 2);
+    out += ' ';
+    genPadded(out, i / 3600000 % 24, 2);
+    out += ':';
+    genPadded(out, i / 60000 % 60, 2);
+    out += ':';
+    genPadded(out, i / 1000 % 60, 2);
+    out += '.';
+    genPadded(out, i % 1000, 3);
+    out += ' ';
+    out += genPick(g, genLevels, GEN_COUNT(genLevels));
+    out += " [";
+    out += genPick(g, genComponents, GEN_COUNT(genComponents));
+    out += "] request ";
+    genNumber(out, i);
+    out += " handled in ";
+    genNumber(out, genBelow(g, 1000));
+    out += " ms (";
+    genSentence(g, out, 1 + genBelow(g, 4));
+    out += ')';
+    out += eol;
+}
+
+static void genC(genState &g, const char *indent)
+{
+    std::string &out = g.out;
+    out += "static ";
+    out += genPick(g, genTypes, GEN_COUNT(genTypes));
+    out += " fn_";
+    genNumber(out, g.counter);
+    out += "(int a, const char *s)\n{\n";
+    int lines = 4 + genBelow(g, 16);
+    for (int i = 0; i < lines; i++)
+    {
+        int depth = 1 + (i % 3 == 2);
+        for (int d = 0; d < depth; d++)
+            out += indent;
+        switch (genBelow(g, 4))
+        {
+        case 0:
+            out += genPick(g, genKeywords, GEN_COUNT(genKeywords));
+            out += " (a > ";
+            genNumber(out, genBelow(g, 100000));
+            out += ")";
+            out += indent;
+            out += "// ";
+            genSentence(g, out, 3);
+            break;
+        case 1:
+            out += "a += s[";
+            genNumber(out, genBelow(g, 64));
+            out += "] * 0x";
+            genNumber(out, genBelow(g, 9999));
+            out += ';';
+            break;
+        case 2:
+            out += "puts(\"";
+            genSentence(g, out, 2 + genBelow(g, 5));
+            out += "\\n\");";
+            break;
+        default:
+            out += "/* ";
+            genSentence(g, out, 4 + genBelow(g, 8));
+            out += " */";
+            break;
+        }
+        out += '\n';
+    }
+    out += indent;
+    out += "return a;\n}\n\n";
+}
+
+/**
+ * Minified JSON objects, with a newline every g.width bytes or so.
+ */
+static void genJson(genState &g)
+{
+    std::string &out = g.out;
+    size_t start = out.size();
+    out += g.line == 0 ? "[" : ",";
+    out += "{\"id\":";
+    genNumber(out, g.counter);
+    out += ",\"name\":\"";
+    out += genPick(g, genWords, GEN_COUNT(genWords));
+    out += "\",\"tags\":[\"";
+    out += genPick(g, genWords, GEN_COUNT(genWords));
+    out += "\",\"";
+    out += genPick(g, genWords, GEN_COUNT(genWords));
+    out += "\"],\"v\":";
+    genNumber(out, genBelow(g, 1000));
+    out += '.';
+    genNumber(out, genBelow(g, 100));
+    out += '}';
+    g.line += (long long)(out.size() - start);
+    if (g.line >= g.width)
+    {
+        out += "]\n";
+        g.line = 0;
+    }
+}
+
+/**
+ * Blocks that open one level deeper each time up to a limit, then close
+ * all the way back out.
+ */
+static void genNested(genState &g)
+{
+    static const int max_depth = 100;
+    std::string &out = g.out;
+    if (g.depth == 0)
+    {
+        out += "void nest_";
+        genNumber(out, g.counter);
+        out += "(void)\n{\n";
+        g.depth = 1;
+    }
+    if (g.depth <= max_depth)
+    {
+        out.append(g.depth * 4, ' ');
+        out += "if (x";
+        genNumber(out, g.depth);
+        out += ") {\n";
+        g.depth++;
+        return;
+    }
+    out.append(g.depth * 4, ' ');
+    out += "return;\n";
+    for (int d = max_depth; d >= 1; d--)
+    {
+        out.append(d * 4, ' ');
+        out += "}\n";
+    }
+    out += "}\n\n";
+    g.depth = 0;
+}
+
+/**
+ * Mostly random bytes, with runs of zeros and embedded strings the way
+ * object files and images have them.
+ */
+static void genBinary(genState &g)
+{
+    std::string &out = g.out;
+    switch (genBelow(g, 8))
+    {
+    case 0:
+        out.append(16 + genBelow(g, 240), '\0');
+        break;
+    case 1:
+        genSentence(g, out, 1 + genBelow(g, 6));
+        out += '\0';
+        break;
+    default:
+        for (int i = 0; i < 32; i++)
+        {
+            uint64_t r = genRand(g);
+            out.append((const char *)&r, sizeof(r));
+        }
+        break;
+    }
+}
+
+/*** output ***/
+
+static void genWrite(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("gencorpus: write");
+            exit(1);
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static long long genParseSize(const char *s)
+{
+    char *end;
+    long long n = strtoll(s, &end, 10);
+    switch (*end)
+    {
+    case 'G':
+    case 'g':
+        n <<= 10;
+        /* fall through */
+    case 'M':
+    case 'm':
+        n <<= 10;
+        /* fall through */
+    case 'K':
+    case 'k':
+        n <<= 10;
+        end++;
+        break;
+    }
+    return *end || n < 0 ? -1 : n;
+}
+
+[[noreturn]] static void usage()
+{
+    fprintf(stderr, "usage: gencorpus c|log|json|tabs|crlf|nested|binary SIZE[K|M|G] "
+                    "[-s SEED] [-w WIDTH] [-o FILE]\n");
+    exit(2);
+}
+
+/*** main ***/
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+        usage();
+    std::string kind = argv[1];
+    long long size = genParseSize(argv[2]);
+    if (size < 0)
+        usage();
+
+    genState g = {};
+    g.rng = 0x9E3779B97F4A7C15ULL;
+    g.width = GEN_JSON_WIDTH;
+    int fd = STDOUT_FILENO;
+    for (int i = 3; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            usage();
+        if (strcmp(argv[i], "-s") == 0)
+            g.rng ^= strtoull(argv[++i], nullptr, 10) * 0xBF58476D1CE4E5B9ULL;
+        else if (strcmp(argv[i], "-w") == 0)
+            g.width = genParseSize(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0)
+        {
+            fd = open(argv[++i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+        }
+        else
+            usage();
+    }
+    if (g.rng == 0 || g.width <= 0)
+        usage();
+
+    void (*gen)(genState &);
+    if (kind == "c")
+        gen = [](genState &s) { genC(s, "    "); };
+    else if (kind == "tabs")
+        gen = [](genState &s) { genC(s, "\t"); };
+    else if (kind == "log")
+        gen = [](genState &s) { genLog(s, "\n"); };
+    else if (kind == "crlf")
+        gen = [](genState &s) { genLog(s, "\r\n"); };
+    else if (kind == "json")
+        gen = genJson;
+    else if (kind == "nested")
+        gen = genNested;
+    else if (kind == "binary")
+        gen = genBinary;
+    else
+        usage();
+
+    g.out.reserve(2 * GEN_BLOCK);
+    long long written = 0;
+    while (written < size)
+    {
+        while (g.out.size() < GEN_BLOCK)
+        {
+            gen(g);
+            g.counter++;
+        }
+        size_t len = (size_t)std::min((long long)g.out.size(), size - written);
+        genWrite(fd, g.out.data(), len);
+        written += (long long)len;
+        g.out.clear();
+    }
+    if (fd != STDOUT_FILENO && close(fd) == -1)
+    {
+        perror("gencorpus: close");
+        return 1;
+    }
+    return 0;
+}
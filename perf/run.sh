@@ -0,0 +1,190 @@
+#!/bin/sh
+# Replay the recorded sessions in perf/scenarios through the headless
+# driver (Bolt --replay) and compare their timings with perf/baselines.
+#
+#   perf/run.sh             compare; exit 1 if any scenario regressed, failed
+#                           to replay or is missing a metric
+#   perf/run.sh --update    rewrite perf/baselines from this machine, noting
+#                           the host and the flags the binary was built with
+#   perf/run.sh --show      print the timings without comparing
+#   perf/run.sh --train     run each scenario once and discard the output,
+#                           to collect a profile for PGO
+#
+# PERF_RUNS       runs per scenario; the best of each metric is kept (5)
+# PERF_PASSES     for --update, times to repeat all the runs; the baseline
+#                 is the median of the passes' bests, so one quiet (or
+#                 busy) minute on the machine doesn't set it (5)
+# PERF_THRESHOLD  percent over the baseline that counts as a regression (25)
+# PERF_SLACK_US   absolute slack for startup_us, which is well under a
+#                 millisecond for most files and flaps otherwise (500)
+# PERF_FLOOR_US   least growth in p50_us and p99_us that counts as a
+#                 regression, on top of PERF_THRESHOLD (50). A keystroke
+#                 takes tens of microseconds in the release build, where
+#                 25% is within the noise of a shared machine.
+# PERF_CORPUS     where the generated corpus lives (perf/corpus)
+# BOLT            the binary to run (../build/release/Bolt, relative to
+#                 perf/). The baselines are for the release build; the
+#                 flags file make writes next to the binary says how it
+#                 was built.
+
+set -e
+cd "$(dirname "$0")"
+bolt=${BOLT:-../build/release/Bolt}
+runs=${PERF_RUNS:-5}
+[ "$1" = "--train" ] && runs=1
+passes=1
+[ "$1" = "--update" ] && passes=${PERF_PASSES:-5}
+threshold=${PERF_THRESHOLD:-25}
+slack=${PERF_SLACK_US:-500}
+floor=${PERF_FLOOR_US:-50}
+corpus=${PERF_CORPUS:-corpus}
+metrics="startup_us p50_us p99_us total_us"
+
+# Regenerate when the generator or its sizes change
+if [ ! "$corpus/.done" -nt gencorpus ] || [ ! "$corpus/.done" -nt corpus.sh ]; then
+    echo "perf: generating corpus in $corpus"
+    sh corpus.sh "$corpus"
+    touch "$corpus/.done"
+fi
+
+# Keep the user's ~/.boltrc and session out of the measurements
+home=$(mktemp -d)
+list=$(mktemp)
+raw=$(mktemp)
+results=$(mktemp)
+trap 'rm -rf "$home" "$list" "$raw" "$results"' EXIT
+grep -v '^#' scenarios > "$list"
+
+# Replay every scenario 'runs' times per pass, one line of key=value
+# pairs per run in $raw after the scenario and the pass. A replay that
+# fails is reported and fails the whole run.
+failed=0
+pass=0
+while [ $pass -lt "$passes" ]; do
+    while read -r name file session; do
+        [ -n "$name" ] || continue
+        i=0
+        while [ $i -lt "$runs" ]; do
+            if out=$(HOME=$home "$bolt" --replay "sessions/$session" "$corpus/$file" < /dev/null); then
+                echo "$out" | sed "s/^/$name $pass /" >> "$raw"
+            else
+                echo "perf: $name: $bolt exited with status $?" >&2
+                failed=1
+            fi
+            i=$((i + 1))
+        done
+    done < "$list"
+    pass=$((pass + 1))
+done
+if [ $failed -ne 0 ]; then
+    echo "perf: replay failed"
+    exit 1
+fi
+
+if [ "$1" = "--train" ]; then
+    echo "perf: trained $bolt"
+    exit 0
+fi
+
+# The best of each metric per scenario and pass, then the median of
+# those over the passes; "-" where a pass had no run that reported it
+awk -v metrics="$metrics" -v passes="$passes" '
+    {
+        for (i = 3; i <= NF; i++) {
+            split($i, kv, "=")
+            key = $1 SUBSEP $2 SUBSEP kv[1]
+            if (!(key in best) || kv[2] + 0 < best[key])
+                best[key] = kv[2] + 0
+        }
+        if (!($1 in seen)) { seen[$1] = 1; order[++n] = $1 }
+    }
+    END {
+        m = split(metrics, names, " ")
+        for (i = 1; i <= n; i++) {
+            line = order[i]
+            for (j = 1; j <= m; j++) {
+                k = 0
+                for (p = 0; p < passes; p++) {
+                    if (!((order[i], p, names[j]) in best))
+                        break
+                    v = best[order[i], p, names[j]]
+                    for (q = k++; q > 0 && sorted[q - 1] > v; q--)
+                        sorted[q] = sorted[q - 1]
+                    sorted[q] = v
+                }
+                line = line " " (k == passes ? sorted[int((k - 1) / 2)] : "-")
+            }
+            print line
+        }
+    }' "$raw" > "$results"
+
+if [ "$1" = "--show" ]; then
+    { echo "scenario $metrics"; cat "$results"; } |
+        awk '{ printf "%-12s", $1; for (i = 2; i <= NF; i++) printf " %12s", $i; printf "\n" }'
+    exit 0
+fi
+
+# What the numbers were measured on, as recorded at the top of baselines
+build=$(cat "$(dirname "$bolt")/flags" 2>/dev/null || echo "unknown")
+host="$(uname -sm), $(grep -m1 'model name' /proc/cpuinfo 2>/dev/null | sed 's/.*: //'), $(nproc) cpus"
+
+if [ "$1" = "--update" ]; then
+    { echo "# build: $build"; echo "# host: $host"; echo "# scenario $metrics"; cat "$results"; } > baselines
+    echo "perf: baselines updated"
+    cat baselines
+    exit 0
+fi
+
+# Numbers from another build or machine don't compare; say so, but
+# compare anyway
+base_build=$(sed -n 's/^# build: //p' baselines)
+base_host=$(sed -n 's/^# host: //p' baselines)
+[ "$build" = "$base_build" ] || echo "perf: baselines are for build \"$base_build\", not \"$build\"" >&2
+[ "$host" = "$base_host" ] || echo "perf: baselines are for host \"$base_host\", not \"$host\"" >&2
+
+# Compare with the baselines. A metric with no result, or a baseline
+# scenario that produced no line at all, counts as a failure.
+status=0
+awk -v threshold="$threshold" -v slack="$slack" -v floor="$floor" -v metrics="$metrics" '
+    BEGIN { m = split(metrics, names, " ") }
+    FNR == NR {
+        if ($1 !~ /^#/ && NF > 0) {
+            for (j = 1; j <= m; j++)
+                base[$1, j] = $(j + 1)
+            based[$1] = 1
+        }
+        next
+    }
+    {
+        seen[$1] = 1
+        printf "%-12s", $1
+        for (j = 1; j <= m; j++) {
+            now = $(j + 1)
+            flag = ""
+            if (now == "-" || now == "") {
+                printf "  %s MISSING", names[j]
+                bad = 1
+            } else if (($1, j) in base) {
+                limit = base[$1, j] * (1 + threshold / 100)
+                if (names[j] == "startup_us")
+                    limit += slack
+                else if (names[j] ~ /^p[0-9]+_us$/ && limit < base[$1, j] + floor)
+                    limit = base[$1, j] + floor
+                if (now > limit) { flag = " REGRESSED"; bad = 1 }
+                printf "  %s %d (base %d)%s", names[j], now, base[$1, j], flag
+            } else {
+                printf "  %s %d (no base)", names[j], now
+            }
+        }
+        printf "\n"
+    }
+    END {
+        for (name in based)
+            if (!(name in seen)) {
+                printf "%-12s  MISSING (no results)\n", name
+                bad = 1
+            }
+        exit bad
+    }' baselines "$results" || status=1
+[ $status -eq 0 ] && echo "perf: ok" || echo "perf: regression over ${threshold}% or missing results"
+exit $status